@@ -7,12 +7,14 @@
 # cli options
 # -h, --help: Show help message
 # -v, --verbose: Enable verbose output
+# -d, --deadline: Keep SCHED_DEADLINE admission control on for `--sched=deadline`
 
 function parse_args {
   while [[ "$#" -gt 0 ]]; do
     case $1 in
       -h|--help) show_help; exit 0 ;;
       -v|--verbose) VERBOSE=true ;;
+      -d|--deadline) DEADLINE=true ;;
       *) echo "Unknown parameter passed: $1"; exit 1 ;;
     esac
     shift
@@ -25,6 +27,7 @@ function show_help {
   echo "Options:"
   echo "  -h, --help      Show this help message"
   echo "  -v, --verbose   Enable verbose output"
+  echo "  -d, --deadline  Keep SCHED_DEADLINE admission control on, for real_time --sched=deadline"
 }
 
 function check_cpu_settings {
@@ -86,6 +89,20 @@ function check_realtime_settings {
       exit 1
   fi
 
+  # -1 turns off RT throttling, but the kernel then also skips every SCHED_DEADLINE admission test.
+  # --sched=deadline refuses to start without them, so keep the kernel default of 950000 instead
+  if [ "$DEADLINE" = true ]; then
+    if [ $(cat /proc/sys/kernel/sched_rt_runtime_us) -eq -1 ]; then
+        echo "Setting sched_rt_runtime_us to 950000 for SCHED_DEADLINE admission control..."
+        echo 950000 | sudo tee /proc/sys/kernel/sched_rt_runtime_us
+    else
+        echo "sched_rt_runtime_us is $(cat /proc/sys/kernel/sched_rt_runtime_us), SCHED_DEADLINE admission control is on."
+    fi
+    echo "SCHED_DEADLINE also requires each service core to be its own root domain, e.g. a cgroup v2 cpuset"
+    echo "partition holding only that core; the kernel refuses deadline tasks pinned to part of a root domain."
+    return
+  fi
+
   if [ $(cat /proc/sys/kernel/sched_rt_runtime_us) -ne -1 ]; then
       echo "Setting sched_rt_runtime_us to -1..."
       echo -1 | sudo tee /proc/sys/kernel/sched_rt_runtime_us
@@ -0,0 +1,131 @@
+/**
+ * @file AllocationGuard.cpp
+ */
+
+#include "AllocationGuard.hpp"
+
+#ifdef RT_ALLOCATION_GUARD
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <malloc.h>
+#include <unistd.h>
+
+#define ALLOCATION_GUARD_MESSAGE "heap allocation on a real-time service thread\n"
+
+// guard state is only touched by its own thread
+static thread_local bool armed = false;
+static thread_local int allowDepth = 0;
+
+void rt::armAllocationGuard()
+{
+  armed = true;
+}
+
+void rt::disarmAllocationGuard()
+{
+  armed = false;
+}
+
+rt::AllowAllocations::AllowAllocations()
+{
+  allowDepth++;
+}
+
+rt::AllowAllocations::~AllowAllocations()
+{
+  allowDepth--;
+}
+
+rt::GuardAllocations::GuardAllocations() : _wasArmed(armed)
+{
+  armed = true;
+}
+
+rt::GuardAllocations::~GuardAllocations()
+{
+  armed = _wasArmed;
+}
+
+static void checkAllocation()
+{
+  if (armed && allowDepth == 0)
+  {
+    // no iostreams here, they could allocate
+    write(STDERR_FILENO, ALLOCATION_GUARD_MESSAGE, sizeof(ALLOCATION_GUARD_MESSAGE) - 1);
+    abort();
+  }
+}
+
+// glibc's allocator behind the replaced entry points; these are exported for exactly this purpose
+extern "C"
+{
+  void *__libc_malloc(size_t size);
+  void *__libc_calloc(size_t count, size_t size);
+  void *__libc_realloc(void *p, size_t size);
+  void *__libc_memalign(size_t alignment, size_t size);
+  void *__libc_valloc(size_t size);
+  void *__libc_pvalloc(size_t size);
+}
+
+// operator new and glibc's internal callers both go through these, so they are the one place to check.
+// free stays glibc's own, there is nothing to check there
+extern "C"
+{
+  void *malloc(size_t size) noexcept
+  {
+    checkAllocation();
+    return __libc_malloc(size);
+  }
+
+  void *calloc(size_t count, size_t size) noexcept
+  {
+    checkAllocation();
+    return __libc_calloc(count, size);
+  }
+
+  void *realloc(void *p, size_t size) noexcept
+  {
+    checkAllocation();
+    return __libc_realloc(p, size);
+  }
+
+  void *memalign(size_t alignment, size_t size) noexcept
+  {
+    checkAllocation();
+    return __libc_memalign(alignment, size);
+  }
+
+  void *aligned_alloc(size_t alignment, size_t size) noexcept
+  {
+    checkAllocation();
+    return __libc_memalign(alignment, size);
+  }
+
+  int posix_memalign(void **p, size_t alignment, size_t size) noexcept
+  {
+    checkAllocation();
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+    {
+      return EINVAL;
+    }
+
+    *p = __libc_memalign(alignment, size);
+    return *p == nullptr ? ENOMEM : 0;
+  }
+
+  void *valloc(size_t size) noexcept
+  {
+    checkAllocation();
+    return __libc_valloc(size);
+  }
+
+  void *pvalloc(size_t size) noexcept
+  {
+    checkAllocation();
+    return __libc_pvalloc(size);
+  }
+}
+
+#endif
@@ -0,0 +1,61 @@
+/**
+ * @file AllocationGuard.hpp
+ * @brief Debug check that real-time service threads stay off the heap.
+ *
+ * Built with -DRT_ALLOCATION_GUARD (make debug) malloc and its siblings are replaced and any
+ * allocation from an armed thread aborts with a message. That covers operator new, C libraries and
+ * glibc's own internal allocations alike, since glibc routes them all through the replaced malloc.
+ * Otherwise everything here compiles away.
+ */
+#pragma once
+
+namespace rt
+{
+#ifdef RT_ALLOCATION_GUARD
+  /**
+   * @brief From now on, abort if the calling thread allocates.
+   */
+  void armAllocationGuard();
+  void disarmAllocationGuard();
+
+  /**
+   * @brief Permit allocations on an armed thread for the lifetime of this object, e.g. for one-off setup such as
+   * a thread's first log.
+   */
+  class AllowAllocations
+  {
+  public:
+    AllowAllocations();
+    ~AllowAllocations();
+  };
+
+  /**
+   * @brief Arm the guard on the calling thread for the lifetime of this object, then restore whatever
+   * state it had, e.g. for one service run on a borrowed thread.
+   */
+  class GuardAllocations
+  {
+  public:
+    GuardAllocations();
+    ~GuardAllocations();
+
+  private:
+    bool _wasArmed;
+  };
+#else
+  inline void armAllocationGuard() {}
+  inline void disarmAllocationGuard() {}
+
+  class AllowAllocations
+  {
+  public:
+    AllowAllocations() {}
+  };
+
+  class GuardAllocations
+  {
+  public:
+    GuardAllocations() {}
+  };
+#endif
+}
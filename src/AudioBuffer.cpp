@@ -1,56 +1,101 @@
 /**
- * @file SharedMemory.cpp
+ * @file AudioBuffer.cpp
  */
 
 #include "AudioBuffer.hpp"
+#include "MemoryLock.hpp"
 
-AudioBuffer::AudioBuffer(size_t initialCapacity, unsigned int channels)
+#include <new>
+#include <stdexcept>
+
+AudioBuffer::AudioBuffer(size_t initialCapacity, unsigned int channels, unsigned int slots)
 {
+  if (slots < 2)
+  {
+    throw std::invalid_argument("AudioBuffer needs at least two slots");
+  }
+
   _bufferSize = initialCapacity;
-  _buffer = new char[_bufferSize];
-  _bufferTwo = new char[_bufferSize];
-  activeBuffer = 0;
+  _numberOfSlots = slots;
+  _slots = nullptr;
+  _views = std::make_unique<const char *[]>(slots);
   this->channels = channels;
+
+  _allocateSlots();
 }
 
 AudioBuffer::~AudioBuffer()
 {
-  delete [] _buffer;
-  delete [] _bufferTwo;
+  _freeSlots();
 }
 
-// define:   size_t getBufferSize();
-//  char *getWriteBuffer();
-// char *getReadBuffer();
-
 size_t AudioBuffer::getBufferSize()
 {
   return _bufferSize;
 }
 
-/// FIX RACE CONDITIONS LOL
+unsigned int AudioBuffer::getNumberOfSlots()
+{
+  return _numberOfSlots;
+}
+
 char *AudioBuffer::getWriteBuffer()
 {
-  if (activeBuffer == 0)
-  {
-    return _buffer;
-  }
-  else
+  return _slotAt(_writeIndex.load(std::memory_order_relaxed));
+}
+
+bool AudioBuffer::publishWriteBuffer()
+{
+  return publishWriteBuffer(getWriteBuffer());
+}
+
+bool AudioBuffer::publishWriteBuffer(const char *external)
+{
+  size_t write = _writeIndex.load(std::memory_order_relaxed);
+  size_t read = _readIndex.load(std::memory_order_acquire);
+
+  // the next write slot must not be one the consumer can still be reading
+  if (write + 1 - read >= _numberOfSlots)
   {
-    return _bufferTwo;
+    return false;
   }
+
+  _views[write % _numberOfSlots] = external;
+  _writeIndex.store(write + 1, std::memory_order_release);
+  return true;
 }
 
 char *AudioBuffer::getReadBuffer()
 {
-  if (activeBuffer == 0)
+  size_t read = _readIndex.load(std::memory_order_relaxed);
+  size_t write = _writeIndex.load(std::memory_order_acquire);
+
+  if (read == write)
   {
-    return _bufferTwo;
+    return nullptr;
   }
-  else
+
+  return const_cast<char *>(_views[read % _numberOfSlots]);
+}
+
+void AudioBuffer::releaseReadBuffer()
+{
+  size_t read = _readIndex.load(std::memory_order_relaxed);
+  size_t write = _writeIndex.load(std::memory_order_acquire);
+
+  if (read == write)
   {
-    return _buffer;
+    return;
   }
+
+  _readIndex.store(read + 1, std::memory_order_release);
+}
+
+size_t AudioBuffer::pending()
+{
+  size_t write = _writeIndex.load(std::memory_order_acquire);
+  size_t read = _readIndex.load(std::memory_order_acquire);
+  return write - read;
 }
 
 void AudioBuffer::setNumberOfChannels(unsigned int channels)
@@ -58,17 +103,14 @@ void AudioBuffer::setNumberOfChannels(unsigned int channels)
   this->channels = channels;
 }
 
+/// Only safe before the producer and consumer are running.
 void AudioBuffer::resizeBuffer(size_t newSize)
 {
   if (newSize != _bufferSize)
   {
-    delete [] _buffer;
-    delete [] _bufferTwo;
-
+    _freeSlots();
     _bufferSize = newSize;
-
-    _buffer = new char[_bufferSize];
-    _bufferTwo = new char[_bufferSize];
+    _allocateSlots();
   }
 }
 
@@ -77,8 +119,28 @@ unsigned int AudioBuffer::getNumberOfChannels()
   return channels;
 }
 
-void AudioBuffer::swap()
+void AudioBuffer::_allocateSlots()
 {
-  activeBuffer = (activeBuffer + 1) % 2;
-  return;
-}
\ No newline at end of file
+  // round each slot up to a whole number of cache lines so slots never share a line
+  _slotStride = (_bufferSize + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+  _slots = static_cast<char *>(::operator new[](_slotStride * _numberOfSlots, std::align_val_t(CACHE_LINE_SIZE)));
+  rt::prefault(_slots, _slotStride * _numberOfSlots);
+  rt::prefault(_views.get(), sizeof(const char *) * _numberOfSlots);
+
+  _writeIndex.store(0, std::memory_order_relaxed);
+  _readIndex.store(0, std::memory_order_relaxed);
+}
+
+void AudioBuffer::_freeSlots()
+{
+  if (_slots)
+  {
+    ::operator delete[](_slots, std::align_val_t(CACHE_LINE_SIZE));
+    _slots = nullptr;
+  }
+}
+
+char *AudioBuffer::_slotAt(size_t index)
+{
+  return _slots + (index % _numberOfSlots) * _slotStride;
+}
@@ -1,31 +1,83 @@
 /**
  * @file AudioBuffer.hpp
  * @brief Shared memory interface
+ *
+ * Lock-free single-producer / single-consumer ring of period-sized slots. The microphone service
+ * is the only producer and the FFT service is the only consumer. The producer always owns the slot
+ * at the write index, so capture never has to wait on the FFT; if the ring is full the freshly
+ * captured period is simply not published and the slot is reused on the next capture.
  */
 
 #pragma once
 
 #include <memory>
 #include <array>
+#include <atomic>
+#include <cstddef>
+
+#define CACHE_LINE_SIZE 64
+#define AUDIO_BUFFER_SLOTS 4
 
 class AudioBuffer
 {
 public:
-  AudioBuffer(size_t initialCapacity, unsigned int channels);
+  AudioBuffer(size_t initialCapacity, unsigned int channels, unsigned int slots = AUDIO_BUFFER_SLOTS);
   ~AudioBuffer();
 
   size_t getBufferSize();
+  unsigned int getNumberOfSlots();
+
+  /**
+   * @brief Producer side. Slot the next period should be captured into. Always valid.
+   */
   char *getWriteBuffer();
+
+  /**
+   * @brief Producer side. Make the write slot visible to the consumer.
+   * @return false if the ring is full; the captured period is dropped and the slot reused.
+   */
+  bool publishWriteBuffer();
+
+  /**
+   * @brief Producer side. Publish a view of memory the producer owns elsewhere (e.g. an ALSA mmap
+   * area) instead of the write slot. The memory must stay valid until the consumer releases it.
+   * @return false if the ring is full.
+   */
+  bool publishWriteBuffer(const char *external);
+
+  /**
+   * @brief Consumer side. Oldest published slot, or nullptr if nothing is pending.
+   */
   char *getReadBuffer();
+
+  /**
+   * @brief Consumer side. Hand the read slot back to the producer.
+   */
+  void releaseReadBuffer();
+
+  /**
+   * @brief Number of published slots the consumer has not released yet.
+   */
+  size_t pending();
+
   void resizeBuffer(size_t newSize);
   unsigned int getNumberOfChannels();
   void setNumberOfChannels(unsigned int channels);
-  void swap();
 
 private:
-  int activeBuffer;
-  char *_buffer;
-  char *_bufferTwo;
+  void _allocateSlots();
+  void _freeSlots();
+
+  char *_slotAt(size_t index);
+
+  // producer and consumer indices live on their own cache lines to avoid false sharing
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> _writeIndex;
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> _readIndex;
+
+  alignas(CACHE_LINE_SIZE) char *_slots;
+  std::unique_ptr<const char *[]> _views;
   size_t _bufferSize;
+  size_t _slotStride;
+  unsigned int _numberOfSlots;
   unsigned int channels;
-};
\ No newline at end of file
+};
@@ -5,105 +5,590 @@
 
 #include "FFT.hpp"
 #include "Logger.hpp"
+#include "MemoryLock.hpp"
 #include <cstdint>
 #include <cmath>
 #include <fftw3.h>
 #include <memory>
 #include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <chrono>
+#include <sstream>
 
-AudioFFT::AudioFFT(std::shared_ptr<AudioBuffer> audioBuffer, std::shared_ptr<logger::LoggerFactory> loggerFactory) {
+#define WISDOM_PLANNER_CORE 0
+#define WISDOM_PLAN_TIME_LIMIT_S 5.0 // longest FFTW_MEASURE may run, and so the longest shutdown waits on it
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//////////////////// SIMD HELPERS ////////////////////
+// The vector path is picked at compile time from the target flags; every path ends with a scalar tail.
+
+// int16 samples -> float scaled by `scale`
+static void convertSamples(const int16_t* in, float* out, size_t count, float scale)
+{
+    size_t i = 0;
+#if defined(__ARM_NEON)
+    float32x4_t vscale = vdupq_n_f32(scale);
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t s = vld1q_s16(in + i);
+        vst1q_f32(out + i,     vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(s))), vscale));
+        vst1q_f32(out + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(s))), vscale));
+    }
+#elif defined(__AVX2__)
+    __m256 vscale = _mm256_set1_ps(scale);
+    for (; i + 8 <= count; i += 8) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(s)), vscale));
+    }
+#elif defined(__SSE2__)
+    __m128 vscale = _mm_set1_ps(scale);
+    for (; i + 8 <= count; i += 8) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        // sign extend by placing each sample in the high half and shifting back down
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+        _mm_storeu_ps(out + i,     _mm_mul_ps(_mm_cvtepi32_ps(lo), vscale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), vscale));
+    }
+#endif
+    for (; i < count; ++i) {
+        out[i] = static_cast<float>(in[i]) * scale;
+    }
+}
+
+// |X|^2 of every complex bin
+static void magnitudeSquared(const fftwf_complex* in, float* out, size_t count)
+{
+    const float* bins = reinterpret_cast<const float*>(in);
+    size_t i = 0;
+#if defined(__ARM_NEON)
+    for (; i + 4 <= count; i += 4) {
+        float32x4x2_t c = vld2q_f32(bins + 2*i); // deinterleaves re / im
+        vst1q_f32(out + i, vmlaq_f32(vmulq_f32(c.val[0], c.val[0]), c.val[1], c.val[1]));
+    }
+#elif defined(__SSE2__) // AVX2 builds use this too, 256-bit shuffles would cross lanes
+    for (; i + 4 <= count; i += 4) {
+        __m128 a = _mm_loadu_ps(bins + 2*i);     // re0 im0 re1 im1
+        __m128 b = _mm_loadu_ps(bins + 2*i + 4); // re2 im2 re3 im3
+        a = _mm_mul_ps(a, a);
+        b = _mm_mul_ps(b, b);
+        __m128 re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm_storeu_ps(out + i, _mm_add_ps(re, im));
+    }
+#endif
+    for (; i < count; ++i) {
+        out[i] = in[i][0]*in[i][0] + in[i][1]*in[i][1];
+    }
+}
+
+//////////////////// AUDIO FFT ////////////////////
+// the FFTW planner is not thread safe
+std::mutex AudioFFT::_plannerMutex;
+
+AudioFFT::AudioFFT(std::shared_ptr<AudioBuffer> audioBuffer, std::shared_ptr<logger::LoggerFactory> loggerFactory, size_t buckets, FFTConfig config) {
     _logger = loggerFactory->createLogger("AudioFFT");
     _audioBuffer = audioBuffer;
-    _fftSize = _audioBuffer->getBufferSize() / sizeof(int16_t);
-    _input  = (double*) fftw_malloc(sizeof(double) * _fftSize);
-    _output = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * (_fftSize/2 + 1));
-    _plan = fftw_plan_dft_r2c_1d(_fftSize, _input, _output, FFTW_MEASURE); 
-    // ^ using a plan (from fftw) here makes the fft much faster to run over and over again
+    _stft = config.stft;
+    _engine = config.engine;
+    _slidingWindow = config.slidingWindow;
+
+    if (_engine == ENGINE_SLIDING_DFT) {
+        if (_stft.enabled) {
+            throw std::invalid_argument("The sliding DFT engine already slides over its own window, disable STFT");
+        }
+        // the sliding window is downmixed to mono and holds the last N samples
+        _channels = 1;
+        _fftSize = _slidingWindow;
+        _history.assign(_fftSize, 0.0f);
+    } else if (_stft.enabled) {
+        if (_stft.hopSize == 0 || _stft.hopSize > _stft.frameSize) {
+            throw std::invalid_argument("STFT hop size must be in [1, frameSize]");
+        }
+        // the service transforms at most once per published period, a shorter hop would be coarsened
+        const size_t periodFrames = _audioBuffer->getBufferSize() / (sizeof(int16_t) * _audioBuffer->getNumberOfChannels());
+        if (_stft.hopSize < periodFrames) {
+            throw std::invalid_argument("STFT hop size must be at least one capture period (" + std::to_string(periodFrames) + " frames)");
+        }
+        // the STFT history is downmixed to mono
+        _channels = 1;
+        _fftSize = _stft.frameSize;
+        _history.assign(2 * _fftSize, 0.0f);
+        _buildWindow();
+    } else {
+        // one transform per channel over the interleaved period
+        _channels = _audioBuffer->getNumberOfChannels();
+        _fftSize = _audioBuffer->getBufferSize() / (sizeof(int16_t) * _channels);
+    }
+    _bins = _fftSize/2 + 1;
+
+    _input  = (float*) fftwf_malloc(sizeof(float) * _fftSize * _channels);
+    _output = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * _bins * _channels);
+    _magSq  = (float*) fftwf_malloc(sizeof(float) * _bins * _channels);
+    std::fill(_input, _input + _fftSize * _channels, 0.0f);
+    rt::prefault(_input, sizeof(float) * _fftSize * _channels);
+    rt::prefault(_history.data(), sizeof(float) * _history.size());
+    rt::prefault(_window.data(), sizeof(float) * _window.size());
+    rt::prefault(_output, sizeof(fftwf_complex) * _bins * _channels);
+    rt::prefault(_magSq, sizeof(float) * _bins * _channels);
+    _measuredPlan = nullptr;
+    _plan = nullptr;
+
+    if (_engine == ENGINE_SLIDING_DFT) {
+        // no transform to plan
+        _activePlan.store(nullptr);
+        setBucketCount(buckets);
+        return;
+    }
+
+    // using a plan (from fftw) makes the fft much faster to run over and over again.
+    // A measured plan from a previous run's wisdom is reused as is; otherwise start on an estimated
+    // plan right away and measure a better one in the background.
+    {
+        std::lock_guard<std::mutex> lock(_plannerMutex);
+        if (fftwf_import_wisdom_from_filename(WISDOM_FILE) == 0) {
+            _logger->log(logger::INFO, "No FFTW wisdom found at " WISDOM_FILE);
+        }
+        _plan = _makePlan(_input, _output, FFTW_MEASURE | FFTW_WISDOM_ONLY);
+    }
+
+    if (_plan) {
+        _logger->log(logger::INFO, "Loaded measured FFT plan from wisdom");
+        _activePlan.store(_plan);
+    } else {
+        {
+            std::lock_guard<std::mutex> lock(_plannerMutex);
+            _plan = _makePlan(_input, _output, FFTW_ESTIMATE);
+        }
+        // published before the planner starts, so a fast measurement can't be overwritten by it
+        _activePlan.store(_plan);
+        _planner = std::jthread([this](std::stop_token stop) { _measurePlan(stop); });
+    }
+
+    setBucketCount(buckets);
 }
 
 AudioFFT::~AudioFFT() {
-    fftw_destroy_plan(_plan);
-    fftw_free(_input);
-    fftw_free(_output);
-    fftw_cleanup();
+    // a measurement in progress runs for at most WISDOM_PLAN_TIME_LIMIT_S before the join returns
+    if (_planner.joinable()) {
+        _planner.request_stop();
+        _planner.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_plannerMutex);
+        if (_plan) {
+            fftwf_destroy_plan(_plan);
+        }
+        if (_measuredPlan) {
+            fftwf_destroy_plan(_measuredPlan);
+        }
+    }
+    fftwf_free(_input);
+    fftwf_free(_output);
+    fftwf_free(_magSq);
+    fftwf_cleanup();
 }
 
-int AudioFFT::performFFT(std::shared_ptr<uint32_t[]> out, size_t buckets) {
-    char* bufferData = _audioBuffer->getReadBuffer();
-    int16_t* samples = reinterpret_cast<int16_t*>(bufferData); // might be able to consolidate these casts to one static cast to double?
+fftwf_plan AudioFFT::_makePlan(float* input, fftwf_complex* output, unsigned flags) {
+    // a single batched plan over the interleaved samples: channel c starts at input[c] and steps by
+    // the channel count, so there is no deinterleave copy. Spectra are stored back to back.
+    int n = (int)_fftSize;
+    return fftwf_plan_many_dft_r2c(1, &n, (int)_channels,
+                                   input, nullptr, (int)_channels, 1,
+                                   output, nullptr, 1, (int)_bins,
+                                   flags);
+}
 
-    for (size_t i = 0; i < _fftSize; ++i) {
-        _input[i] = static_cast<double>(samples[i]);
-    }
+void AudioFFT::_measurePlan(std::stop_token stop) {
+    // the constructor runs on the RT sequencer thread, don't inherit its core or SCHED_FIFO priority
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(WISDOM_PLANNER_CORE, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
 
-    if (_logger->baseLevel() >= logger::TRACE)
+    sched_param sch;
+    sch.sched_priority = 0;
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &sch);
+
+    // FFTW_MEASURE overwrites its arrays, so plan on scratch buffers of the same size and alignment
+    float* input = (float*) fftwf_malloc(sizeof(float) * _fftSize * _channels);
+    fftwf_complex* output = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * _bins * _channels);
+
+    fftwf_plan measured = nullptr;
     {
-        // Print _input buffer for debugging
-        std::stringstream output;
-        for (size_t i = 0; i < _fftSize; ++i) {
-            output << _input[i] << " ";
+        std::lock_guard<std::mutex> lock(_plannerMutex);
+        // FFTW can't be interrupted once it is measuring, so the time limit is what bounds a shutdown
+        // that arrives mid-measurement; the limit is planner global, reset it for everyone else
+        if (!stop.stop_requested()) {
+            fftwf_set_timelimit(WISDOM_PLAN_TIME_LIMIT_S);
+            measured = _makePlan(input, output, FFTW_MEASURE);
+            fftwf_set_timelimit(FFTW_NO_TIMELIMIT);
+        }
+        // a plan cut short by the time limit is still the best one found, keep it for the next run
+        if (measured && fftwf_export_wisdom_to_filename(WISDOM_FILE) == 0) {
+            _logger->log(logger::ERROR, "Failed to write FFTW wisdom to " WISDOM_FILE);
+        }
+    }
+
+    fftwf_free(input);
+    fftwf_free(output);
+
+    if (measured) {
+        _measuredPlan = measured;
+        _activePlan.store(measured, std::memory_order_release);
+        _logger->log(logger::INFO, "Switched to measured FFT plan");
+    }
+}
+
+void AudioFFT::_buildWindow() {
+    const size_t n = _stft.frameSize;
+    _window.resize(n);
+
+    double sum = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        double x = 2.0 * M_PI * (double)i / (double)n; // periodic form, overlap-adds cleanly
+        double w;
+        switch (_stft.window) {
+            case WINDOW_HANN:
+                w = 0.5 - 0.5 * std::cos(x);
+                break;
+            case WINDOW_BLACKMAN_HARRIS:
+                w = 0.35875 - 0.48829 * std::cos(x) + 0.14128 * std::cos(2.0 * x) - 0.01168 * std::cos(3.0 * x);
+                break;
+            default:
+                w = 1.0;
+                break;
+        }
+        _window[i] = (float)w;
+        sum += w;
+    }
+
+    // unit coherent gain, so a tone reads the same level whichever window is picked
+    const float gain = (float)((double)n / sum);
+    for (size_t i = 0; i < n; ++i) {
+        _window[i] *= gain;
+    }
+}
+
+bool AudioFFT::_ingestHop(const int16_t* samples) {
+    const size_t channels = _audioBuffer->getNumberOfChannels();
+    const size_t frames = _audioBuffer->getBufferSize() / (sizeof(int16_t) * channels);
+    const float scale = 1.0f / (32768.0f * (float)channels);
+
+    // downmix each frame to mono and write it to both halves of the history ring
+    for (size_t f = 0; f < frames; ++f) {
+        int32_t sum = 0;
+        for (size_t c = 0; c < channels; ++c) {
+            sum += samples[f * channels + c];
         }
-        _logger->log(logger::TRACE, output.str());
+        float mono = (float)sum * scale;
+
+        _history[_historyPos] = mono;
+        _history[_historyPos + _fftSize] = mono;
+        _historyPos = (_historyPos + 1) % _fftSize;
+    }
+
+    _samplesSinceTransform += frames;
+    if (_samplesSinceTransform < _stft.hopSize) {
+        return false;
+    }
+    // hopSize >= frames, so at most one hop is due; carry the rest so the average hop stays exact
+    _samplesSinceTransform -= _stft.hopSize;
+
+    // oldest sample of the frame sits at _historyPos
+    const float* frame = _history.data() + _historyPos;
+    for (size_t i = 0; i < _fftSize; ++i) {
+        _input[i] = frame[i] * _window[i];
     }
 
-    fftw_execute(_plan);
+    return true;
+}
+
+size_t AudioFFT::getNumberOfChannels() {
+    return _channels;
+}
 
-    const double sampleRate = 48000.0;
-    const double binWidth = sampleRate / (double)_fftSize;
-    const double minFreq = 20.0;
-    const double maxFreq = 15000.0;
+void AudioFFT::setBucketCount(size_t buckets) {
+    const double binWidth = SAMPLE_RATE / (double)_fftSize;
     //ratio is so each bucket spans a constant factor of the frequncy ; f_min * r^num_buckets = f_max
-    double ratio = std::pow(maxFreq/minFreq, 1.0 / (double)buckets);
+    double ratio = std::pow(MAX_FREQ/MIN_FREQ, 1.0 / (double)buckets);
+
+    _bucketCount = buckets;
+    _bucketTable.resize(buckets);
 
     //then loop through values of r^i
     for (size_t b = 0; b < buckets; ++b)
     {
-        double f_lo = minFreq * std::pow(ratio, (double)b);
-        double f_hi = minFreq * std::pow(ratio, (double)(b + 1));
+        double f_lo = MIN_FREQ * std::pow(ratio, (double)b);
+        double f_hi = MIN_FREQ * std::pow(ratio, (double)(b + 1));
 
         size_t idx_lo = (size_t)std::ceil(f_lo / binWidth);
         size_t idx_hi = (size_t)std::floor(f_hi / binWidth);
 
-        // clamp to valid range [1 ... N/2] (not sure how fast this call is, might change)
+        // clamp to valid range [1 ... N/2]
         idx_lo = std::clamp(idx_lo, (size_t)1, _fftSize/2);
         idx_hi = std::clamp(idx_hi, (size_t)1, _fftSize/2);
 
-        if (idx_hi < idx_lo) { //i.e. no bins possible
-            out[b] = 0;
-            continue;
+        if (idx_hi < idx_lo) { //i.e. no bins possible, the scan loop never runs
+            idx_lo = 1;
+            idx_hi = 0;
         }
 
-        // NEW: find *max* magnitude in bin before dB conversion (rather than prior *sum*, as buckets now unequal width)
-        double maxMag = 0.0;
-        for (size_t i = idx_lo; i <= idx_hi; ++i)
+        _bucketTable[b] = {idx_lo, idx_hi};
+    }
+
+    _selectEngine();
+}
+
+void AudioFFT::_computeSpectrum(FFTEngine engine) {
+    if (engine == ENGINE_GOERTZEL) {
+        _goertzel();
+        return;
+    }
+
+    if (engine == ENGINE_SLIDING_DFT) {
+        // the state is already current, _slideBlock did the work
+        for (size_t j = 0; j < _goertzelBins.size(); ++j) {
+            _magSq[_goertzelBins[j]] = (float)(_slidingRe[j]*_slidingRe[j] + _slidingIm[j]*_slidingIm[j]);
+        }
+        return;
+    }
+
+    // new-array execute, so the plan can be swapped for the measured one at any time
+    fftwf_execute_dft_r2c(_activePlan.load(std::memory_order_acquire), _input, _output);
+    magnitudeSquared(_output, _magSq, _bins * _channels);
+}
+
+void AudioFFT::_goertzel() {
+    const size_t count = _goertzelBins.size();
+    float* s1 = _goertzelS1.data();
+    float* s2 = _goertzelS2.data();
+    const float* coeff = _goertzelCoeff.data();
+
+    for (size_t c = 0; c < _channels; ++c)
+    {
+        std::fill(_goertzelS1.begin(), _goertzelS1.end(), 0.0f);
+        std::fill(_goertzelS2.begin(), _goertzelS2.end(), 0.0f);
+
+        // every tracked bin advances together per sample; the inner loop is independent across bins,
+        // so the compiler can vectorize it
+        for (size_t n = 0; n < _fftSize; ++n)
         {
-            double re = _output[i][0];
-            double im = _output[i][1];
-            double mag = std::sqrt(re*re + im*im);
-            if (mag > maxMag) {
-                maxMag = mag;
+            const float x = _input[n * _channels + c];
+            for (size_t j = 0; j < count; ++j)
+            {
+                float s0 = x + coeff[j] * s1[j] - s2[j];
+                s2[j] = s1[j];
+                s1[j] = s0;
             }
         }
 
-        // the db conversion may be wholly unnecessary I have not made up my mind but its simple enough to do so I'm doing it for now
-        double ref = 32768.0; // (2^15) 
-        double magRatio = maxMag / ref;
-        double magdB;
-        if (magRatio <= 0.0) {
-            magdB = -100.0;  // treat zero mag. as -100 dB
-        } else {
-            magdB = 20.0 * log10(magRatio);
+        // |X[k]|^2, the same scale as the unnormalized FFTW output
+        float* magSq = _magSq + c * _bins;
+        for (size_t j = 0; j < count; ++j)
+        {
+            magSq[_goertzelBins[j]] = s1[j]*s1[j] + s2[j]*s2[j] - coeff[j]*s1[j]*s2[j];
+        }
+    }
+}
+
+void AudioFFT::_selectEngine() {
+    _goertzelBins.clear();
+    _goertzelCoeff.clear();
+    for (const BucketRange& range : _bucketTable) {
+        for (size_t k = range.lo; k <= range.hi; ++k) {
+            _goertzelBins.push_back(k);
+            _goertzelCoeff.push_back((float)(2.0 * std::cos(2.0 * M_PI * (double)k / (double)_fftSize)));
+        }
+    }
+    _goertzelS1.assign(_goertzelBins.size(), 0.0f);
+    _goertzelS2.assign(_goertzelBins.size(), 0.0f);
+    rt::prefault(_goertzelBins.data(), sizeof(size_t) * _goertzelBins.size());
+    rt::prefault(_goertzelCoeff.data(), sizeof(float) * _goertzelCoeff.size());
+    rt::prefault(_goertzelS1.data(), sizeof(float) * _goertzelS1.size());
+    rt::prefault(_goertzelS2.data(), sizeof(float) * _goertzelS2.size());
+
+    if (_engine == ENGINE_SLIDING_DFT) {
+        _resetSlidingState();
+    }
+
+    if (_engine != ENGINE_AUTO) {
+        _activeEngine = _engine;
+        return;
+    }
+
+    // benchmark the plan performFFT will actually run, with no planner competing for the CPU. Without
+    // wisdom that means waiting out the measurement, once; later runs load the plan from wisdom
+    if (_planner.joinable()) {
+        _logger->log(logger::INFO, "Waiting for the measured FFT plan before benchmarking engines");
+        _planner.join();
+    }
+
+    // benchmark both engines on the current layout and keep the faster one
+    const double fftwUs = _benchmarkEngine(ENGINE_FFTW);
+    const double goertzelUs = _benchmarkEngine(ENGINE_GOERTZEL);
+    _activeEngine = goertzelUs < fftwUs ? ENGINE_GOERTZEL : ENGINE_FFTW;
+
+    _logger->logFormat(logger::INFO, "Spectrum engine for %zu buckets (%zu bins): fftw %gus, goertzel %gus, using %s",
+                       static_cast<size_t>(_bucketCount), _goertzelBins.size(), fftwUs, goertzelUs,
+                       _activeEngine == ENGINE_GOERTZEL ? "goertzel" : "fftw");
+}
+
+void AudioFFT::_resetSlidingState() {
+    const size_t count = _goertzelBins.size();
+    _slidingCos.resize(count);
+    _slidingSin.resize(count);
+    _slidingRe.assign(count, 0.0);
+    _slidingIm.assign(count, 0.0);
+    _slidingDampingN = std::pow(SLIDING_DFT_DAMPING, (double)_fftSize);
+    rt::prefault(_slidingCos.data(), sizeof(double) * count);
+    rt::prefault(_slidingSin.data(), sizeof(double) * count);
+    rt::prefault(_slidingRe.data(), sizeof(double) * count);
+    rt::prefault(_slidingIm.data(), sizeof(double) * count);
+
+    for (size_t j = 0; j < count; ++j) {
+        double w = 2.0 * M_PI * (double)_goertzelBins[j] / (double)_fftSize;
+        _slidingCos[j] = std::cos(w);
+        _slidingSin[j] = std::sin(w);
+
+        // seed newly tracked bins with a direct DFT of the current window, oldest sample first
+        for (size_t n = 0; n < _fftSize; ++n) {
+            double x = _history[(_historyPos + n) % _fftSize];
+            _slidingRe[j] += x * std::cos(w * (double)n);
+            _slidingIm[j] -= x * std::sin(w * (double)n);
+        }
+    }
+}
+
+void AudioFFT::_slideBlock(const int16_t* samples) {
+    const size_t channels = _audioBuffer->getNumberOfChannels();
+    const size_t frames = _audioBuffer->getBufferSize() / (sizeof(int16_t) * channels);
+    const float scale = 1.0f / (32768.0f * (float)channels);
+    const size_t count = _goertzelBins.size();
+
+    double* re = _slidingRe.data();
+    double* im = _slidingIm.data();
+    const double* cs = _slidingCos.data();
+    const double* sn = _slidingSin.data();
+
+    for (size_t f = 0; f < frames; ++f) {
+        int32_t sum = 0;
+        for (size_t c = 0; c < channels; ++c) {
+            sum += samples[f * channels + c];
+        }
+        float mono = (float)sum * scale;
+
+        // swap the oldest sample for the newest, then rotate every bin by its twiddle. O(bins) per sample.
+        // Damped by r < 1 per step (and r^N on the leaving sample) so rounding errors die out
+        const double delta = (double)mono - _slidingDampingN * (double)_history[_historyPos];
+        _history[_historyPos] = mono;
+        _historyPos = (_historyPos + 1) % _fftSize;
+
+        for (size_t j = 0; j < count; ++j) {
+            double r = SLIDING_DFT_DAMPING * re[j] + delta;
+            double i = SLIDING_DFT_DAMPING * im[j];
+            re[j] = r * cs[j] - i * sn[j];
+            im[j] = r * sn[j] + i * cs[j];
         }
+    }
+}
+
+double AudioFFT::_benchmarkEngine(FFTEngine engine) {
+    const int runs = 32;
+
+    _computeSpectrum(engine); // warm caches
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; ++i) {
+        _computeSpectrum(engine);
+    }
+    auto stop = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::micro>(stop - start).count() / runs;
+}
+
+uint32_t AudioFFT::_toNormalizedDb(float maxMagSq) {
+    // the db conversion may be wholly unnecessary I have not made up my mind but its simple enough to do so I'm doing it for now
+    // 20*log10(mag/ref) == 10*log10(mag^2/ref^2), so the squared magnitude never needs a sqrt.
+    // samples are already scaled by 1/2^15 on conversion, so the reference is 1
+    if (maxMagSq <= 0.0f) {
+        return 0;  // zero mag. is -100 dB, below the -96 dB floor
+    }
+
+    double magdB = 10.0 * log10(static_cast<double>(maxMagSq));
+    double dBNormalized = std::max(magdB, -96.0) + 96.0;
+
+    return static_cast<uint32_t>(dBNormalized); //store scaled dB as uint32_t[] for HJ's portion
+}
+
+int AudioFFT::performFFT(std::span<uint32_t> out, size_t buckets) {
+    if (out.size() < _channels * buckets)
+    {
+        _logger->log(logger::ERROR, "performFFT output span too small");
+        return -1;
+    }
 
-        if (magdB < -96.0) { 
-            magdB = -96.0; 
+    char* bufferData = _audioBuffer->getReadBuffer();
+    if (bufferData == nullptr)
+    {
+        _logger->log(logger::ERROR, "performFFT called with no audio pending");
+        return -1;
+    }
+
+    if (buckets != _bucketCount) {
+        setBucketCount(buckets);
+    }
+
+    const int16_t* samples = reinterpret_cast<const int16_t*>(bufferData);
+    if (_engine == ENGINE_SLIDING_DFT) {
+        _slideBlock(samples);
+    } else if (_stft.enabled) {
+        if (!_ingestHop(samples)) {
+            return 1;
         }
-        double dBNormalized = magdB + 96.0;
-        if (dBNormalized < 0.0) {
-            dBNormalized = 0.0;
+    } else {
+        convertSamples(samples, _input, _fftSize * _channels, 1.0f / 32768.0f);
+    }
+
+    if (_logger->enabled(logger::TRACE))
+    {
+        // summarise the input rather than dumping it, this runs on the guarded FFT thread
+        float peak = 0.0f;
+        for (size_t i = 0; i < _fftSize * _channels; ++i) {
+            peak = std::max(peak, std::fabs(_input[i]));
         }
+        _logger->logFormat(logger::TRACE, "FFT input %zu samples, peak %f", _fftSize * _channels, static_cast<double>(peak));
+    }
+
+    _computeSpectrum(_activeEngine);
 
-        out[b] = static_cast<uint32_t>(dBNormalized); //store scaled dB as uint32_t[] for HJ's portion
+    // out is laid out [channel][bucket]
+    for (size_t c = 0; c < _channels; ++c)
+    {
+        const float* magSq = _magSq + c * _bins;
+
+        for (size_t b = 0; b < _bucketCount; ++b)
+        {
+            const BucketRange range = _bucketTable[b];
+
+            // find *max* magnitude in bin before dB conversion (rather than prior *sum*, as buckets are unequal width).
+            // compared as magnitude squared so there is no sqrt per bin; empty buckets have lo > hi and skip the loop
+            float maxMagSq = 0.0f;
+            for (size_t i = range.lo; i <= range.hi; ++i)
+            {
+                maxMagSq = std::max(maxMagSq, magSq[i]);
+            }
+
+            out[c * _bucketCount + b] = _toNormalizedDb(maxMagSq);
+        }
     }
 
     return 0;
@@ -10,6 +10,53 @@
 #include <cmath>
 #include <iostream>
 #include <memory>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <span>
+
+#define SAMPLE_RATE 48000.0
+#define MIN_FREQ 20.0
+#define MAX_FREQ 15000.0
+#define WISDOM_FILE "fftw_wisdom.dat"
+// sliding DFT pole radius; < 1 so float round-off decays instead of accumulating over a long run
+#define SLIDING_DFT_DAMPING 0.99999
+
+enum WindowType
+{
+  WINDOW_NONE,
+  WINDOW_HANN,
+  WINDOW_BLACKMAN_HARRIS,
+};
+
+/**
+ * Short-time FFT settings. When enabled each transform covers the last frameSize mono samples and a
+ * new transform runs every hopSize samples, so consecutive frames overlap by frameSize - hopSize.
+ * The FFT runs once per captured period, so hopSize may not be shorter than one period.
+ */
+struct STFTConfig
+{
+  bool enabled = false;
+  size_t frameSize = 2048;
+  size_t hopSize = 480;
+  WindowType window = WINDOW_HANN;
+};
+
+enum FFTEngine
+{
+  ENGINE_AUTO,      // benchmark both at setBucketCount against the measured plan and keep the faster
+  ENGINE_FFTW,      // full spectrum from one batched FFTW plan
+  ENGINE_GOERTZEL,  // only the bins the buckets cover, one Goertzel filter per bin
+  ENGINE_SLIDING_DFT, // bins the buckets cover, updated per sample over a sliding window. Never picked by AUTO
+};
+
+struct FFTConfig
+{
+  STFTConfig stft;
+  FFTEngine engine = ENGINE_AUTO;
+  size_t slidingWindow = 480;  // ENGINE_SLIDING_DFT window in samples, independent of the capture period
+};
 
 // Useful resources:
 // 1. https://www.nti-audio.com/en/support/know-how/fast-fourier-transform-fft#:~:text=The%20%22Fast%20Fourier%20Transform%22%20(,frequency%20information%20about%20the%20signal.
@@ -17,16 +64,85 @@
 class AudioFFT
 {
 public:
-  explicit AudioFFT(std::shared_ptr<AudioBuffer> audioBuffer, std::shared_ptr<logger::LoggerFactory> loggerFactory);
+  explicit AudioFFT(std::shared_ptr<AudioBuffer> audioBuffer, std::shared_ptr<logger::LoggerFactory> loggerFactory, size_t buckets, FFTConfig config = FFTConfig());
   ~AudioFFT();
 
-  int performFFT(std::shared_ptr<uint32_t[]> out, size_t buckets);
+  /**
+   * @brief Transform the oldest pending period into buckets.
+   * @param out at least getNumberOfChannels() * buckets values, laid out [channel][bucket].
+   * With ENGINE_SLIDING_DFT every period, however short, yields a spectrum of the last slidingWindow samples.
+   * @return 0 if out holds a new spectrum, 1 if an STFT hop is still accumulating, -1 on error.
+   */
+  int performFFT(std::span<uint32_t> out, size_t buckets);
+
+  /**
+   * @brief Number of spectra performFFT produces: the buffer's channel count, or 1 in STFT and sliding DFT mode.
+   */
+  size_t getNumberOfChannels();
+
+  /**
+   * @brief Precompute the log-spaced bucket layout and pick the spectrum engine for it. Not
+   * real-time safe; performFFT only calls it when the bucket count changes. With ENGINE_AUTO it
+   * first waits for a background FFTW measurement to finish.
+   */
+  void setBucketCount(size_t buckets);
 
 private:
+  struct BucketRange
+  {
+    size_t lo;
+    size_t hi;
+  };
+
+  uint32_t _toNormalizedDb(float maxMagSq);
+  void _measurePlan(std::stop_token stop);
+  fftwf_plan _makePlan(float* input, fftwf_complex* output, unsigned flags);
+  void _computeSpectrum(FFTEngine engine);
+  void _goertzel();
+  void _selectEngine();
+  double _benchmarkEngine(FFTEngine engine);
+  void _slideBlock(const int16_t* samples);
+  void _resetSlidingState();
+
+  FFTEngine _engine;
+  FFTEngine _activeEngine = ENGINE_FFTW;
+  std::vector<size_t> _goertzelBins;   // every bin some bucket covers
+  std::vector<float> _goertzelCoeff;   // 2cos(2*pi*k/N) per tracked bin
+  std::vector<float> _goertzelS1;
+  std::vector<float> _goertzelS2;
+
+  // damped sliding DFT: S_k(n) = (r*S_k(n-1) + x(n) - r^N*x(n-N)) * e^{j2pik/N}, r = SLIDING_DFT_DAMPING,
+  // kept in double; the damping makes rounding errors decay rather than build up over a long run
+  size_t _slidingWindow;
+  std::vector<double> _slidingCos;
+  std::vector<double> _slidingSin;
+  std::vector<double> _slidingRe;
+  std::vector<double> _slidingIm;
+  double _slidingDampingN = 1.0; // SLIDING_DFT_DAMPING^window, applied to the sample leaving the window
+  void _buildWindow();
+  bool _ingestHop(const int16_t* samples);
+
+  STFTConfig _stft;
+  std::vector<float> _window;
+  std::vector<float> _history;  // mirrored ring of 2*frameSize, so the last frame is always contiguous
+  size_t _historyPos = 0;
+  size_t _samplesSinceTransform = 0;
+
+  std::vector<BucketRange> _bucketTable;
+  size_t _bucketCount = 0;
+
   std::shared_ptr<AudioBuffer> _audioBuffer;
-  fftw_plan _plan;
-  double* _input;
-  fftw_complex* _output; 
-  size_t _fftSize;
+  // single precision is plenty for 16-bit audio and halves the memory traffic
+  fftwf_plan _plan;           // wisdom or estimated plan made at construction
+  fftwf_plan _measuredPlan;   // set by the background planner when there was no wisdom
+  std::atomic<fftwf_plan> _activePlan;
+  std::jthread _planner;
+  static std::mutex _plannerMutex;
+  float* _input;
+  fftwf_complex* _output;
+  float* _magSq;
+  size_t _fftSize;   // samples per channel in one transform
+  size_t _channels;
+  size_t _bins;      // _fftSize/2 + 1 bins per channel
   logger::Logger* _logger;
 };
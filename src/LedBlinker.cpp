@@ -9,6 +9,7 @@
 #include <unistd.h>
 #include <exception>
 #include <memory>
+#include <algorithm>
 
 #define ARRAY_SIZE(stuff)       (sizeof(stuff) / sizeof(stuff[0]))
 
@@ -71,9 +72,9 @@ LedBlinker::~LedBlinker()
   ws2811_fini(&ledstring);
 }
 
-void LedBlinker::setColors(std::shared_ptr<uint32_t[]> audio)
+void LedBlinker::setColors(std::span<uint32_t> audio)
 {
   // Commit the changes to the LED strip
-  update_led_matrix_from_sound(matrix, audio.get(), led_count);
+  update_led_matrix_from_sound(matrix, audio.data(), std::min(led_count, static_cast<int>(audio.size())));
   update_led_color(&ledstring, matrix, led_count);
 }
@@ -9,6 +9,7 @@ extern "C" {
 }
 
 #include <memory>
+#include <span>
 
 class LedBlinker
 {
@@ -16,7 +17,7 @@ public:
   LedBlinker(int ledCount);
   ~LedBlinker();
 
-  void setColors(std::shared_ptr<uint32_t[]> audio);
+  void setColors(std::span<uint32_t> audio);
 
 private:
   ws2811_led_t* matrix;
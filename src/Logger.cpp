@@ -4,26 +4,490 @@
  */
 
 #include "Logger.hpp"
+#include "AllocationGuard.hpp"
 
 #include <syslog.h>
 #include <iostream>
 #include <fstream>
 #include <memory>
 #include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+#define SPEC_MAX_PREFIX 10 // longest '%', flags, width and precision the drain replays
+
+namespace
+{
+  enum ArgKind : uint8_t
+  {
+    ARG_SIGNED,
+    ARG_UNSIGNED,
+    ARG_CHAR,
+    ARG_DOUBLE,
+    ARG_POINTER,
+    ARG_STRING,
+  };
+
+  struct Record
+  {
+    uint64_t timestampNs;  // CLOCK_MONOTONIC
+    const char *format;    // the format id; nullptr when text already holds the whole message
+    uint32_t context;      // id from registerContext
+    uint8_t level;
+    uint8_t argCount;
+    ArgKind kinds[LOG_MAX_ARGS];
+    uint64_t args[LOG_MAX_ARGS]; // raw bits; a string argument is its offset into text
+    char text[LOG_RECORD_TEXT];
+  };
+
+  class Ring
+  {
+  public:
+    Ring()
+    {
+      _records = std::make_unique<Record[]>(LOG_RING_RECORDS);
+    }
+
+    /**
+     * @brief Slot for the next record, filled in place, or nullptr if the ring is full.
+     */
+    Record *claim()
+    {
+      uint64_t write = _write.load(std::memory_order_relaxed);
+      if (write - _read.load(std::memory_order_acquire) >= LOG_RING_RECORDS)
+      {
+        _dropped.store(_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return nullptr;
+      }
+
+      return &_records[write & (LOG_RING_RECORDS - 1)];
+    }
+
+    void publish()
+    {
+      _write.store(_write.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool pop(Record &record)
+    {
+      uint64_t read = _read.load(std::memory_order_relaxed);
+      if (read == _write.load(std::memory_order_acquire))
+      {
+        return false;
+      }
+
+      record = _records[read & (LOG_RING_RECORDS - 1)];
+      _read.store(read + 1, std::memory_order_release);
+      return true;
+    }
+
+    uint64_t dropped() const
+    {
+      return _dropped.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::unique_ptr<Record[]> _records;
+    alignas(64) std::atomic<uint64_t> _write{0};
+    alignas(64) std::atomic<uint64_t> _read{0};
+    std::atomic<uint64_t> _dropped{0};
+  };
+
+  // one conversion specification of a printf format
+  struct Spec
+  {
+    size_t length = 1;       // characters from the '%' through the conversion
+    size_t prefixLength = 1; // '%', flags, width and precision; the length modifier follows
+    std::string_view modifier;
+    char conversion = 0;
+    bool supported = false;
+  };
+
+  std::mutex registryMutex;
+  std::vector<std::unique_ptr<Ring>> rings;
+  std::vector<std::string> contexts;
+
+  // drain side only, reused between drains; the registry lock is held just long enough to copy
+  // the ring list and new contexts, so registering never waits behind the drain's I/O
+  std::mutex drainMutex;
+  std::vector<Ring *> drainRings;
+  std::vector<std::string> drainContexts;
+  std::vector<Record> pending;
+
+  thread_local Ring *threadRing = nullptr;
+
+  uint64_t monotonicNs()
+  {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + static_cast<uint64_t>(now.tv_nsec);
+  }
+
+  Spec parseSpec(const char *start)
+  {
+    Spec spec;
+    const char *p = start + 1;
+    bool star = false;
+
+    while (*p != '\0' && std::strchr("-+ #0", *p) != nullptr)
+    {
+      p++;
+    }
+    while (*p != '\0' && (std::isdigit(static_cast<unsigned char>(*p)) || *p == '.' || *p == '*'))
+    {
+      star |= *p == '*';
+      p++;
+    }
+    spec.prefixLength = static_cast<size_t>(p - start);
+
+    const char *modifier = p;
+    while (*p != '\0' && std::strchr("hljztL", *p) != nullptr)
+    {
+      p++;
+    }
+    spec.modifier = std::string_view(modifier, static_cast<size_t>(p - modifier));
+
+    if (*p == '\0')
+    {
+      spec.length = static_cast<size_t>(p - start);
+      return spec;
+    }
+
+    spec.conversion = *p;
+    spec.length = static_cast<size_t>(p - start) + 1;
+
+    // '*' widths would need their own arguments, long double and wide strings do not fit the record
+    spec.supported = !star && spec.prefixLength <= SPEC_MAX_PREFIX && spec.modifier.size() <= 2 &&
+                     std::strchr("diouxXcfFeEgGaAps%", spec.conversion) != nullptr &&
+                     spec.modifier != "L" && !(spec.conversion == 's' && !spec.modifier.empty());
+    return spec;
+  }
+
+  ArgKind argKind(char conversion)
+  {
+    switch (conversion)
+    {
+      case 'd':
+      case 'i':
+        return ARG_SIGNED;
+      case 'o':
+      case 'u':
+      case 'x':
+      case 'X':
+        return ARG_UNSIGNED;
+      case 'c':
+        return ARG_CHAR;
+      case 'p':
+        return ARG_POINTER;
+      case 's':
+        return ARG_STRING;
+      default:
+        return ARG_DOUBLE;
+    }
+  }
+
+  int64_t readSigned(std::string_view modifier, va_list &args)
+  {
+    if (modifier == "hh")
+      return static_cast<signed char>(va_arg(args, int));
+    if (modifier == "h")
+      return static_cast<short>(va_arg(args, int));
+    if (modifier == "l")
+      return va_arg(args, long);
+    if (modifier == "ll")
+      return va_arg(args, long long);
+    if (modifier == "j")
+      return va_arg(args, intmax_t);
+    if (modifier == "z")
+      return va_arg(args, std::make_signed_t<size_t>);
+    if (modifier == "t")
+      return va_arg(args, ptrdiff_t);
+    return va_arg(args, int);
+  }
+
+  uint64_t readUnsigned(std::string_view modifier, va_list &args)
+  {
+    if (modifier == "hh")
+      return static_cast<unsigned char>(va_arg(args, unsigned int));
+    if (modifier == "h")
+      return static_cast<unsigned short>(va_arg(args, unsigned int));
+    if (modifier == "l")
+      return va_arg(args, unsigned long);
+    if (modifier == "ll")
+      return va_arg(args, unsigned long long);
+    if (modifier == "j")
+      return va_arg(args, uintmax_t);
+    if (modifier == "z")
+      return va_arg(args, size_t);
+    if (modifier == "t")
+      return va_arg(args, std::make_unsigned_t<ptrdiff_t>);
+    return va_arg(args, unsigned int);
+  }
+
+  /**
+   * @brief Copy the raw arguments of format into record. Strings are copied into the record's text,
+   * truncated once it is full.
+   * @return false if the format is not one the drain can replay.
+   */
+  bool capture(Record &record, const char *format, va_list &args)
+  {
+    // the last byte stays a terminator so a string that no longer fits can point at it
+    const size_t textCapacity = LOG_RECORD_TEXT - 1;
+    size_t textUsed = 0;
+    record.text[textCapacity] = '\0';
+    record.argCount = 0;
+
+    for (const char *p = format; *p != '\0'; p++)
+    {
+      if (*p != '%')
+      {
+        continue;
+      }
+
+      Spec spec = parseSpec(p);
+      if (!spec.supported)
+      {
+        return false;
+      }
+      p += spec.length - 1;
+
+      if (spec.conversion == '%')
+      {
+        continue;
+      }
+      if (record.argCount == LOG_MAX_ARGS)
+      {
+        return false;
+      }
+
+      ArgKind kind = argKind(spec.conversion);
+      uint64_t &arg = record.args[record.argCount];
+      switch (kind)
+      {
+        case ARG_SIGNED:
+        {
+          int64_t value = readSigned(spec.modifier, args);
+          std::memcpy(&arg, &value, sizeof(arg));
+          break;
+        }
+        case ARG_UNSIGNED:
+          arg = readUnsigned(spec.modifier, args);
+          break;
+        case ARG_CHAR:
+          arg = static_cast<uint64_t>(va_arg(args, int));
+          break;
+        case ARG_DOUBLE:
+        {
+          double value = va_arg(args, double);
+          std::memcpy(&arg, &value, sizeof(arg));
+          break;
+        }
+        case ARG_POINTER:
+          arg = reinterpret_cast<uintptr_t>(va_arg(args, void *));
+          break;
+        case ARG_STRING:
+        {
+          const char *value = va_arg(args, const char *);
+          if (value == nullptr)
+          {
+            value = "(null)";
+          }
+
+          size_t room = textCapacity - textUsed;
+          if (room == 0)
+          {
+            arg = textCapacity;
+            break;
+          }
+
+          size_t length = strnlen(value, room - 1);
+          std::memcpy(record.text + textUsed, value, length);
+          record.text[textUsed + length] = '\0';
+          arg = textUsed;
+          textUsed += length + 1;
+          break;
+        }
+      }
+      record.kinds[record.argCount++] = kind;
+    }
+
+    return true;
+  }
+
+  /**
+   * @brief Replay a captured record through snprintf, one conversion at a time.
+   */
+  void formatRecord(const Record &record, char *line, size_t size)
+  {
+    if (record.format == nullptr)
+    {
+      snprintf(line, size, "%s", record.text);
+      return;
+    }
+
+    size_t used = 0;
+    size_t arg = 0;
+    for (const char *p = record.format; *p != '\0' && used + 1 < size; p++)
+    {
+      if (*p != '%')
+      {
+        line[used++] = *p;
+        continue;
+      }
+
+      Spec spec = parseSpec(p);
+      p += spec.length - 1;
+      if (spec.conversion == '%')
+      {
+        line[used++] = '%';
+        continue;
+      }
+      if (arg >= record.argCount)
+      {
+        break;
+      }
+
+      // the same flags, width and precision, with every integer widened to long long
+      char conversion[SPEC_MAX_PREFIX + 4];
+      std::memcpy(conversion, p - spec.length + 1, spec.prefixLength);
+      size_t length = spec.prefixLength;
+      ArgKind kind = record.kinds[arg];
+      if (kind == ARG_SIGNED || kind == ARG_UNSIGNED)
+      {
+        conversion[length++] = 'l';
+        conversion[length++] = 'l';
+      }
+      conversion[length++] = spec.conversion;
+      conversion[length] = '\0';
+
+      uint64_t raw = record.args[arg++];
+      char *out = line + used;
+      size_t room = size - used;
+      int written = 0;
+      switch (kind)
+      {
+        case ARG_SIGNED:
+        {
+          int64_t value;
+          std::memcpy(&value, &raw, sizeof(value));
+          written = snprintf(out, room, conversion, static_cast<long long>(value));
+          break;
+        }
+        case ARG_UNSIGNED:
+          written = snprintf(out, room, conversion, static_cast<unsigned long long>(raw));
+          break;
+        case ARG_CHAR:
+          written = snprintf(out, room, conversion, static_cast<int>(raw));
+          break;
+        case ARG_DOUBLE:
+        {
+          double value;
+          std::memcpy(&value, &raw, sizeof(value));
+          written = snprintf(out, room, conversion, value);
+          break;
+        }
+        case ARG_POINTER:
+          written = snprintf(out, room, conversion, reinterpret_cast<void *>(static_cast<uintptr_t>(raw)));
+          break;
+        case ARG_STRING:
+          written = snprintf(out, room, conversion, record.text + std::min(raw, static_cast<uint64_t>(LOG_RECORD_TEXT - 1)));
+          break;
+      }
+
+      if (written > 0)
+      {
+        used += std::min(static_cast<size_t>(written), room - 1);
+      }
+    }
+    line[used] = '\0';
+  }
+}
+
+uint32_t logger::registerContext(const std::string &context)
+{
+  std::lock_guard<std::mutex> lock(registryMutex);
+  contexts.push_back(context);
+  return static_cast<uint32_t>(contexts.size() - 1);
+}
+
+void logger::registerThread()
+{
+  if (threadRing != nullptr)
+  {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(registryMutex);
+  rings.push_back(std::make_unique<Ring>());
+  threadRing = rings.back().get();
+}
+
+void logger::push(LogLevel level, uint32_t context, const char *format, va_list args)
+{
+  if (threadRing == nullptr)
+  {
+    // only threads that skipped registerThread get here, and only on their first log
+    rt::AllowAllocations allow;
+    registerThread();
+  }
+
+  Record *record = threadRing->claim();
+  if (record == nullptr)
+  {
+    return;
+  }
+
+  record->timestampNs = monotonicNs();
+  record->context = context;
+  record->level = static_cast<uint8_t>(level);
+
+  va_list captured;
+  va_copy(captured, args);
+  if (capture(*record, format, captured))
+  {
+    record->format = format;
+  }
+  else
+  {
+    // formats the drain cannot replay are formatted here, still without allocating
+    record->format = nullptr;
+    vsnprintf(record->text, sizeof(record->text), format, args);
+  }
+  va_end(captured);
+
+  threadRing->publish();
+}
 
 class FactoryLogger : public logger::Logger
 {
 public:
-  FactoryLogger(logger::LoggerFactory *factory, std::string context, logger::LogLevel level): Logger(context, level)
+  FactoryLogger(std::string context, logger::LogLevel level): Logger(context, level)
   {
-    _factory = factory;
+    _contextId = logger::registerContext(contextStr());
   }
 
   ~FactoryLogger()
   {
   }
 
+  using logger::Logger::log;
+
   void log(logger::LogLevel level, std::string message) override
+  {
+    log(level, message.c_str());
+  }
+
+  void logv(logger::LogLevel level, const char *format, va_list args) override
   {
     if (level > _level)
     {
@@ -31,24 +495,125 @@ public:
       return;
     }
 
-    std::stringstream str;
-    if (level == logger::ERROR)
+    logger::push(level, _contextId, format, args);
+  }
+
+private:
+  uint32_t _contextId;
+};
+
+logger::Logger *logger::LoggerFactory::createLogger(std::string context)
+{
+  return new FactoryLogger(context, _loglevel);
+}
+
+void logger::LoggerFactory::startDrain()
+{
+  if (_drainThread.joinable())
+  {
+    return;
+  }
+
+  _drainThread = std::jthread([this](std::stop_token stop)
+  {
+    // stay off the real-time cores and out of the SCHED_FIFO band
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(LOG_DRAIN_CORE, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+
+    sched_param sch;
+    sch.sched_priority = 0;
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &sch);
+
+    while (!stop.stop_requested())
+    {
+      drain();
+      std::this_thread::sleep_for(std::chrono::milliseconds(LOG_DRAIN_PERIOD_MS));
+    }
+  });
+}
+
+void logger::LoggerFactory::stopDrain()
+{
+  if (_drainThread.joinable())
+  {
+    _drainThread.request_stop();
+    _drainThread.join();
+  }
+
+  drain();
+}
+
+void logger::LoggerFactory::drain()
+{
+  std::lock_guard<std::mutex> drainLock(drainMutex);
+  {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (size_t i = drainRings.size(); i < rings.size(); i++)
     {
-      str << logger::logLevelStr(level) << contextStr() << " " << message << std::endl;
+      drainRings.push_back(rings[i].get());
     }
-    else
+    drainContexts.insert(drainContexts.end(), contexts.begin() + static_cast<std::ptrdiff_t>(drainContexts.size()), contexts.end());
+  }
+
+  Record record;
+  uint64_t dropped = 0;
+  for (Ring *ring : drainRings)
+  {
+    while (ring->pop(record))
     {
-      str << logger::logLevelStr(level) << contextStr() << " " << message << std::endl;
+      pending.push_back(record);
     }
+    dropped += ring->dropped();
+  }
+
+  // each ring is in order already; merge the threads by timestamp
+  std::stable_sort(pending.begin(), pending.end(), [](const Record &a, const Record &b)
+  {
+    return a.timestampNs < b.timestampNs;
+  });
 
-    _factory->writeLn(level, contextStr(), str.str());
+  char line[LOG_LINE_MAX];
+  for (const Record &queued : pending)
+  {
+    formatRecord(queued, line, sizeof(line));
+    _writeLn(static_cast<LogLevel>(queued.level), queued.context < drainContexts.size() ? drainContexts[queued.context] : "[unknown]", line);
   }
+  pending.clear();
 
-private:
-  logger::LoggerFactory *_factory;
-};
+  if (dropped > _reportedDrops)
+  {
+    snprintf(line, sizeof(line), "%llu records dropped, log rings were full", static_cast<unsigned long long>(dropped - _reportedDrops));
+    _writeLn(WARNING, "[Logger]", line);
+    _reportedDrops = dropped;
+  }
 
-logger::Logger *logger::LoggerFactory::createLogger(std::string context)
+  if (_loggerType == FILE && file.is_open())
+  {
+    file.flush();
+  }
+}
+
+void logger::LoggerFactory::_writeLn(LogLevel level, const std::string &context, const char *message)
 {
-  return new FactoryLogger(this, context, _loglevel);
+  if (_loggerType == STDOUT)
+  {
+    std::cout << logLevelStr(level) << context << " " << message << std::endl;
+  }
+  else if (_loggerType == SYSLOG)
+  {
+    syslog(LOG_INFO, "%s%s %s", logLevelStr(level).c_str(), context.c_str(), message);
+  }
+  else if (_loggerType == FILE)
+  {
+    if (file.is_open())
+    {
+      file << logLevelStr(level) << context << " " << message << "\n";
+    }
+  }
+  else
+  {
+    throw std::runtime_error("Not implemented yet");
+  }
 }
@@ -1,6 +1,16 @@
 /**
  * @file Logger.hpp 
  * A logger that forwards logs to a low priority context.
+ *
+ * Each logging thread pushes fixed-size binary records (format string, level, timestamp and the raw
+ * printf arguments) into its own single-producer ring. The LoggerFactory's drain thread, pinned off
+ * the real-time cores under SCHED_OTHER, does all of the formatting and I/O. logFormat and
+ * log(const char *) never block, allocate or format on the caller's thread; log(std::string) costs
+ * whatever building the string cost the caller, so real-time paths use logFormat. If a ring is full
+ * the record is dropped and counted.
+ *
+ * A record carries at most LOG_RECORD_TEXT - 1 bytes of copied string data, so a plain message or
+ * the %s arguments of one call are cut at that length.
  */
 #pragma once
 
@@ -9,6 +19,17 @@
 #include <syslog.h>
 #include <iostream>
 #include <fstream>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdint>
+#include <thread>
+
+#define LOG_LINE_MAX 256         // longest formatted message the drain writes
+#define LOG_RING_RECORDS 512     // per thread, power of two
+#define LOG_MAX_ARGS 8           // more than this and the message is formatted on the caller's stack
+#define LOG_RECORD_TEXT 192      // bytes for copied %s arguments in a record; longer ones are truncated
+#define LOG_DRAIN_PERIOD_MS 50
+#define LOG_DRAIN_CORE 0
 
 namespace logger
 {
@@ -47,6 +68,23 @@ namespace logger
     }
   }
 
+  /**
+   * @brief Name a logger context, e.g. "[FFTService]". Not real-time safe; call at startup.
+   */
+  uint32_t registerContext(const std::string &context);
+
+  /**
+   * @brief Give the calling thread its own record ring. Not real-time safe; real-time threads call
+   * this before their loop. Any other thread gets its ring on its first log.
+   */
+  void registerThread();
+
+  /**
+   * @brief Queue a message on the calling thread's ring. Never blocks, allocates or formats unless
+   * the format needs more than LOG_MAX_ARGS arguments or a '*' width.
+   */
+  void push(LogLevel level, uint32_t context, const char *format, va_list args);
+
   class Logger
   {
   public:
@@ -58,6 +96,40 @@ namespace logger
     virtual ~Logger() = default;
     virtual void log(LogLevel level, std::string message) = 0;
 
+    /**
+     * @brief Checks the level first, so disabled messages cost nothing. The message is copied into
+     * the record and truncated to LOG_RECORD_TEXT - 1 bytes.
+     */
+    void log(LogLevel level, const char *message)
+    {
+      logFormat(level, "%s", message);
+    }
+
+    /**
+     * @brief printf style logging. The arguments are captured raw and formatted by the drain thread;
+     * %s arguments are copied, so they need not outlive the call.
+     */
+    __attribute__((format(printf, 3, 4)))
+    void logFormat(LogLevel level, const char *format, ...)
+    {
+      if (!enabled(level))
+      {
+        return;
+      }
+
+      va_list args;
+      va_start(args, format);
+      logv(level, format, args);
+      va_end(args);
+    }
+
+    virtual void logv(LogLevel level, const char *format, va_list args) = 0;
+
+    bool enabled(LogLevel level)
+    {
+      return level <= _level;
+    }
+
     logger::LogLevel baseLevel()
     {
       return _level;
@@ -106,58 +178,39 @@ namespace logger
 
     ~LoggerFactory()
     {
+      stopDrain();
+
       if (file.is_open())
       {
         file.close();
       }
     }
 
-    void clear()
-    {
-      buffer.str("");
-      buffer.clear();
-    }
+    Logger *createLogger(std::string context);
 
-    void flush()
-    {
-      // for each line
-      std::string line;
-      std::istringstream iss(buffer.str());
-      while (std::getline(iss, line))
-      {
-        if (_loggerType == STDOUT)
-        {
-          std::cout << line << std::endl;
-        }
-        else if (_loggerType == SYSLOG)
-        {
-          syslog(LOG_INFO, "%s", line.c_str());
-        }
-        else if (_loggerType == FILE)
-        {
-          if (file.is_open())
-          {
-            file << line << std::endl;
-          }
-        }
-        else
-        {
-          throw std::runtime_error("Not implemented yet");
-        }
-      }
-    }
+    /**
+     * @brief Start formatting and writing queued records on a low priority thread. Until then records
+     * wait in the rings, and are dropped once a ring fills.
+     */
+    void startDrain();
 
-    Logger *createLogger(std::string context);
+    /**
+     * @brief Join the drain thread and write whatever is still queued.
+     */
+    void stopDrain();
 
-    void writeLn(LogLevel loglevel, std::string context, std::string str)
-    {
-      buffer << logLevelStr(loglevel) << context << " " << str << "\n";
-    } 
+    /**
+     * @brief Write every queued record, oldest first across all threads.
+     */
+    void drain();
 
   private:
-    std::stringstream buffer;
+    void _writeLn(LogLevel level, const std::string &context, const char *message);
+
     LoggerType _loggerType;
     LogLevel _loglevel;
     std::ofstream file;
+    uint64_t _reportedDrops = 0;
+    std::jthread _drainThread;
   };
 }
@@ -10,6 +10,9 @@
 #include "RealTime.hpp"
 #include "FFT.hpp"
 #include "LedBlinker.hpp"
+#include "SpectrumSnapshot.hpp"
+#include "Trace.hpp"
+#include "Telemetry.hpp"
 
 #include <fftw3.h> // FFT library
 #include <csignal>
@@ -18,10 +21,18 @@
 #include <cstdint>
 #include <thread>
 #include <memory>
+#include <vector>
+#include <span>
 
 #define SEQUENCER_CORE 2
 #define SERVICES_CORE 3
 
+#define SUB_PERIOD_MS 2
+#define FRAMES_PER_MS 48
+#define DEADLINE_CALIBRATION_ITERATIONS 100 // sequencer periods under SCHED_FIFO before switching to SCHED_DEADLINE
+#define DEADLINE_WCET_MARGIN 1.5
+#define TRACE_FILE "trace.json" // open in ui.perfetto.dev or chrome://tracing
+
 #define TENMS 10
 #define TWENTYMS 20
 #define SEQ 115900
@@ -29,22 +40,19 @@
 FibonacciLoadGenerator fib10(SEQ, TENMS);
 FibonacciLoadGenerator fib20(SEQ, TWENTYMS);
 
-std::counting_semaphore<1> _fftReady(0);
-std::counting_semaphore<1> _fftDone(1);
-std::mutex _fftOutputMutex;
-
-volatile uint32_t fftOutput[16] = {0};
+SpectrumSnapshot spectrumSnapshot;
 
 struct ServiceConfig
 {
   size_t numberOfBuckets;
+  FFTConfig fft;
 };
 
 class MicrophoneService : public Service
 {
 public:
-  MicrophoneService(std::string id, uint16_t period, uint8_t priority, uint8_t affinity, std::shared_ptr<logger::LoggerFactory> loggerFactory, std::shared_ptr<AudioBuffer> audioBuffer, std::shared_ptr<Microphone> microphone, ServiceConfig serviceConfig)
-    : Service("microphone[" + id + "]", period, priority, affinity, loggerFactory)
+  MicrophoneService(std::string id, uint16_t period, uint8_t priority, uint8_t affinity, std::shared_ptr<logger::LoggerFactory> loggerFactory, std::shared_ptr<AudioBuffer> audioBuffer, std::shared_ptr<Microphone> microphone, ServiceConfig serviceConfig, ReleaseMode releaseMode = RELEASE_CLOCK)
+    : Service("microphone[" + id + "]", period, priority, affinity, loggerFactory, releaseMode)
   {
     _audioBuffer = audioBuffer;
     _microphone = microphone;
@@ -58,38 +66,47 @@ public:
   }
 
 protected:
+  bool _waitForEvent(int timeoutMs) override
+  {
+    // errors still release the service so GetFrames can report them
+    return _microphone->WaitForFrames(timeoutMs) != 0;
+  }
+
   ServiceStatus _serviceFunction() override
   {
     _logger->log(logger::TRACE, "Entering MicrophoneService::_serviceFunction");
 
+    // Capture and publish one period; never waits on the FFT service
     int err = _microphone->GetFrames(_audioBuffer);
 
-    if (err == -2)
+    if (err == Mic::MIC_BUFFER_OVERRUN)
     {
       _logger->log(logger::ERROR, "Buffer overrun");
+      return DEGRADED;
     }
-    else if (err < 0)
+    else if (err == Mic::MIC_NOT_READY)
     {
-      _logger->log(logger::ERROR, "Failed to get frames from microphone");
-      return FAILURE;
+      // released ahead of the ALSA clock; publishing nothing keeps the FFT service from running dry
+      _logger->log(logger::DEBUG, "No full period captured yet");
+      return DEGRADED;
     }
-    else
+    else if (err == Mic::MIC_RING_FULL)
     {
-      _logger->log(logger::TRACE, "Got " + std::to_string(err) + " frames from microphone");
+      _logger->log(logger::ERROR, "Audio ring full, dropping captured period");
+      return DEGRADED;
     }
-
-    bool acquired = _fftDone.try_acquire_for(std::chrono::milliseconds(_period));
-    if (!acquired)
+    else if (err < 0)
     {
-      _logger->log(logger::ERROR, "MicrophoneService timed out waiting for FFT service to finish");
+      _logger->log(logger::ERROR, "Failed to get frames from microphone");
       return FAILURE;
     }
+    else if (err > 0)
+    {
+      _logger->logFormat(logger::TRACE, "Got %d frames from microphone", err);
+      return DEGRADED;
+    }
 
-    // Swap buffers
-    _audioBuffer->swap();
-
-    // Notify FFT service that data is ready
-    _fftReady.release();
+    // returning SUCCESS releases the FFT service through the sequencer's pipeline
 
     _logger->log(logger::TRACE, "Exiting MicrophoneService::_serviceFunction");
 
@@ -103,16 +120,23 @@ private:
   ServiceConfig _serviceConfig;
 };
 
+// every slot the microphone can publish ahead of the FFT must be able to queue its release
+static_assert(SERVICE_MAX_PENDING_RELEASES >= AUDIO_BUFFER_SLOTS);
+
 class FFTService : public Service
 {
 public:
   FFTService(std::string id, uint16_t period, uint8_t priority, uint8_t affinity, std::shared_ptr<logger::LoggerFactory> loggerFactory, std::shared_ptr<AudioBuffer> audioBuffer, ServiceConfig serviceConfig)
-    : Service("fft[" + id + "]", period, priority, affinity, loggerFactory)
+    : Service("fft[" + id + "]", period, priority, affinity, loggerFactory, RELEASE_UPSTREAM)
   {
     _audioBuffer = audioBuffer;
     _serviceConfig = serviceConfig;
     _logger = loggerFactory->createLogger("FFTService");
-    _fft = new AudioFFT(audioBuffer, loggerFactory); // only one channel
+    _fft = new AudioFFT(audioBuffer, loggerFactory, serviceConfig.numberOfBuckets, serviceConfig.fft);
+
+    // sized once here, the service function never allocates
+    _out.assign(_fft->getNumberOfChannels() * serviceConfig.numberOfBuckets, 0);
+    rt::prefault(_out.data(), sizeof(uint32_t) * _out.size());
   }
 
   ~FFTService()
@@ -126,29 +150,37 @@ protected:
   {
     _logger->log(logger::TRACE, "Entering FFTService::_serviceFunction");
 
-    bool acquired = _fftReady.try_acquire_for(std::chrono::milliseconds(_period));
-
-    if (!acquired)
+    if (_audioBuffer->pending() == 0)
     {
-      _logger->log(logger::ERROR, "FFTService timed out waiting for microphone data");
+      _logger->log(logger::ERROR, "FFTService released with no microphone data");
       return FAILURE;
     }
 
-    auto _out = std::make_shared<uint32_t[]>(_serviceConfig.numberOfBuckets);
-    _fft->performFFT(_out, _serviceConfig.numberOfBuckets);
+    // one published period per release: the microphone releases once for every slot it publishes,
+    // so periods queued while a previous run was slow are worked off by the releases queued with them
+    bool fresh = _fft->performFFT(_out, _serviceConfig.numberOfBuckets) == 0;
+    _audioBuffer->releaseReadBuffer();
 
-    _fftDone.release();
+    if (!fresh)
+    {
+      // STFT hop still accumulating, keep the last published spectrum
+      return SUCCESS;
+    }
 
     // OUTPUT
-    _fftOutputMutex.lock(); //////////////////////////////////////////// critical section
-    
-    // Copy FFT output to shared buffer
-    for (int i = 0; i < _serviceConfig.numberOfBuckets; i++)
+    // the displays show one bar per bucket, so take the louder channel
+    uint32_t loudest[SPECTRUM_MAX_BUCKETS] = {0};
+    size_t buckets = std::min(_serviceConfig.numberOfBuckets, static_cast<size_t>(SPECTRUM_MAX_BUCKETS));
+    for (size_t i = 0; i < buckets; i++)
     {
-      fftOutput[i] = _out[i];
+      for (size_t c = 0; c < _fft->getNumberOfChannels(); c++)
+      {
+        loudest[i] = std::max(loudest[i], _out[c * _serviceConfig.numberOfBuckets + i]);
+      }
     }
 
-    _fftOutputMutex.unlock(); //////////////////////////////////////////// critical section
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    spectrumSnapshot.publish(loudest, buckets, std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
 
 
     _logger->log(logger::TRACE, "Exiting FFTService::_serviceFunction");
@@ -161,6 +193,7 @@ private:
   ServiceConfig _serviceConfig;
 
   AudioFFT *_fft; 
+  std::vector<uint32_t> _out;
 };
 
 class BeeperService : public Service
@@ -184,24 +217,28 @@ protected:
   ServiceStatus _serviceFunction() override
   {
     _logger->log(logger::TRACE, "Entering BeeperService::_serviceFunction");
-    _fftOutputMutex.lock(); ////////////////////////////////// critical section
-    
-    for (size_t i = 0; i < _serviceConfig.numberOfBuckets; i++)
+
+    if (!spectrumSnapshot.read(_frame, _frame.generation))
     {
-      ((double *)_internalBuffer)[i] = fftOutput[i];
+      // nothing new since the last redraw
+      return SUCCESS;
     }
 
-    _fftOutputMutex.unlock(); //////////////////////////////// critical section
+    for (size_t i = 0; i < _frame.buckets; i++)
+    {
+      ((double *)_internalBuffer)[i] = _frame.magnitudes[i];
+    }
 
     // print internal buffer
-    if (_logger->baseLevel() >= logger::DEBUG)
+    if (_logger->enabled(logger::DEBUG))
     {
-      std::stringstream output;
-      for (size_t i = 0; i < _serviceConfig.numberOfBuckets; i++)
+      char output[LOG_LINE_MAX];
+      size_t used = 0;
+      for (size_t i = 0; i < _serviceConfig.numberOfBuckets && used < sizeof(output); i++)
       {
-        output << ((double *)_internalBuffer)[i] << " ";
+        used += snprintf(output + used, sizeof(output) - used, "%g ", ((double *)_internalBuffer)[i]);
       }
-      _logger->log(logger::DEBUG, output.str());
+      _logger->log(logger::DEBUG, output);
     }
 
     clear(); // Clear the screen for the new frame
@@ -214,7 +251,7 @@ protected:
       // 0 - 70
       int baseLined = ((double *)_internalBuffer)[i] - 50.0;
 
-      _logger->log(logger::DEBUG, "baseLined: " + std::to_string(baseLined));
+      _logger->logFormat(logger::DEBUG, "baseLined: %d", baseLined);
 
       int intensity = static_cast<int>(baseLined / 70.0 * 10.0);
 
@@ -237,6 +274,7 @@ private:
   logger::Logger *_logger;
   double *_internalBuffer;
   ServiceConfig _serviceConfig;
+  SpectrumFrame _frame;
 };
 
 class LEDBlinker : public Service
@@ -246,7 +284,6 @@ public:
     : Service("ledblinker[" + id + "]", period, priority, affinity, loggerFactory)
   {
     _serviceConfig = serviceConfig;
-    _internalBuffer = std::make_shared<uint32_t[]>(sizeof(uint32_t) * _serviceConfig.numberOfBuckets);
     _logger = loggerFactory->createLogger("LEDBlinker");
     _ledBlinker = std::make_unique<LedBlinker>(serviceConfig.numberOfBuckets);
   }
@@ -260,50 +297,23 @@ protected:
   {
     _logger->log(logger::TRACE, "Entering LEDBlinker::_serviceFunction");
 
-    _fftOutputMutex.lock(); ////////////////////////////////// critical section
-    
-    for (size_t i = 0; i < _serviceConfig.numberOfBuckets; i++)
+    // the DMA render runs on a private copy, so a slow LED write can't hold up the FFT service
+    if (!spectrumSnapshot.read(_frame, _frame.generation))
     {
-      _internalBuffer[i] = fftOutput[i];
+      return SUCCESS;
     }
-    _ledBlinker->setColors(_internalBuffer);
 
-    _fftOutputMutex.unlock(); //////////////////////////////// critical section    
+    _ledBlinker->setColors(std::span<uint32_t>(_frame.magnitudes, _frame.buckets));
 
     _logger->log(logger::TRACE, "Exiting LEDBlinker::_serviceFunction");
+    return SUCCESS;
   }
 
 private:
   logger::Logger *_logger;
-  std::shared_ptr<uint32_t[]> _internalBuffer;
   ServiceConfig _serviceConfig;
   std::unique_ptr<LedBlinker> _ledBlinker;
-};
-
-class LogsToFileService : public Service
-{
-public:
-  LogsToFileService(std::string id, uint16_t period, uint8_t priority, uint8_t affinity, std::shared_ptr<logger::LoggerFactory> loggerFactory, ServiceConfig serviceConfig)
-    : Service("logstofile[" + id + "]", period, priority, affinity, loggerFactory)
-  {
-    _factory = loggerFactory;
-  }
-
-  ~LogsToFileService(){
-
-  }
-
-protected:
-  ServiceStatus _serviceFunction() override
-  {
-    _factory->flush();
-    _factory->clear();
-
-    return SUCCESS;
-  }
-
-private:
-  std::shared_ptr<logger::LoggerFactory> _factory;
+  SpectrumFrame _frame;
 };
 
 std::shared_ptr<std::atomic<bool>> keepRunning; 
@@ -317,27 +327,63 @@ void interruptHandler(int sig)
 void runSequencer(std::shared_ptr<RealTimeSettings> realTimeSettings)
 {
   std::shared_ptr<logger::LoggerFactory> loggerFactory = realTimeSettings->getLoggerFactory();
+  // formats and writes every service's log records from a low priority thread off the real-time cores
+  loggerFactory->startDrain();
 
   int maxPriority = sched_get_priority_max(SCHED_FIFO);
-  int minPriority = sched_get_priority_min(SCHED_FIFO);
 
   Sequencer* sequencer = realTimeSettings->createSequencer(10, maxPriority, SEQUENCER_CORE);
 
+  // addService runs the response-time analysis on these declared WCETs; the first run has none
+  sequencer->setSchedulabilityPolicy(realTimeSettings->schedulabilityPolicy());
+  if (realTimeSettings->wcetFromLastRun() && sequencer->loadWcetEstimates(STATISTICS_FILE) == 0)
+  {
+    std::cerr << "No execution times recorded in " << STATISTICS_FILE << ", services are admitted without a declared WCET" << std::endl;
+  }
+
   ServiceConfig serviceConfig;
   serviceConfig.numberOfBuckets = 8;
+  serviceConfig.fft.stft.enabled = realTimeSettings->stftEnabled(); // 2048 point Hann frames with a 480 sample (one period) hop when enabled
+  serviceConfig.fft.engine = realTimeSettings->fftEngine(); // sliding with event capture publishes every SUB_PERIOD_MS
+
+  // the sliding DFT costs O(bins) per sample whatever the block size, so with event capture it can
+  // take short ALSA periods and publish a fresh spectrum for each one
+  ReleaseMode captureRelease = realTimeSettings->eventDrivenCapture() ? RELEASE_EVENT : RELEASE_CLOCK;
+  bool subPeriod = captureRelease == RELEASE_EVENT && serviceConfig.fft.engine == ENGINE_SLIDING_DFT;
+  uint16_t capturePeriod = subPeriod ? SUB_PERIOD_MS : 10;
 
-  std::shared_ptr<AudioBuffer> audioBuffer = std::make_shared<AudioBuffer>(960 * 2, 2);
+  std::shared_ptr<AudioBuffer> audioBuffer = std::make_shared<AudioBuffer>(FRAMES_PER_MS * capturePeriod * 2 * sizeof(int16_t), 2);
   MicrophoneFactory microphoneFactory(loggerFactory);
-  std::shared_ptr<Microphone> microphone = microphoneFactory.createMicrophone(audioBuffer, "hw:3,0");
+  std::shared_ptr<Microphone> microphone = microphoneFactory.createMicrophone(audioBuffer, "hw:3,0", realTimeSettings->captureMode());
 
   // starts service threads instantly, but will not run anything
   // TODO: Create pattern that creates services while adding them to the sequencer, as this prevents dangling threads.
-  auto serviceOne = std::make_unique<MicrophoneService>("1", 10, maxPriority - 1, SERVICES_CORE, loggerFactory, audioBuffer, microphone, serviceConfig); 
-  auto serviceTwo = std::make_unique<FFTService>("2", 10, maxPriority - 2, SERVICES_CORE, loggerFactory, audioBuffer, serviceConfig);
+  auto serviceOne = std::make_unique<MicrophoneService>("1", capturePeriod, maxPriority - 1, SERVICES_CORE, loggerFactory, audioBuffer, microphone, serviceConfig, captureRelease); 
+  auto serviceTwo = std::make_unique<FFTService>("2", capturePeriod, maxPriority - 2, SERVICES_CORE, loggerFactory, audioBuffer, serviceConfig);
+  Service *microphoneStage = serviceOne.get();
+  Service *fftStage = serviceTwo.get();
+
+  // clock released services run back to back on the sequencer core, in priority order
+  sequencer->useCyclicExecutive(realTimeSettings->cyclicExecutive());
+
+  // under SCHED_DEADLINE the audio services first run for DEADLINE_CALIBRATION_ITERATIONS sequencer periods
+  // under SCHED_FIFO so their runtime budget can be sized from the measured WCET
+  SchedulingPolicy schedulingPolicy = realTimeSettings->schedulingPolicy();
+  if (schedulingPolicy == SCHEDULING_DEADLINE)
+  {
+    sequencer->useDeadlineScheduling(DEADLINE_CALIBRATION_ITERATIONS, DEADLINE_WCET_MARGIN);
+  }
+  serviceOne->setSchedulingPolicy(schedulingPolicy);
+  serviceTwo->setSchedulingPolicy(schedulingPolicy);
+  serviceOne->guardAllocations(true);
+  serviceTwo->guardAllocations(true);
 
   sequencer->addService(std::move(serviceOne));
   sequencer->addService(std::move(serviceTwo));
 
+  // the FFT starts as soon as a capture is published rather than on the next tick
+  sequencer->addDependency(microphoneStage, fftStage);
+
   if (realTimeSettings->outputType() == CONSOLE)
   {
     initscr(); // Initialize ncurses
@@ -345,6 +391,7 @@ void runSequencer(std::shared_ptr<RealTimeSettings> realTimeSettings)
     curs_set(0); // Hide the cursor
     clear();   // Clear the screen
     auto serviceThree = std::make_unique<BeeperService>("3", 100, maxPriority - 3, SERVICES_CORE, loggerFactory, audioBuffer, serviceConfig);
+    serviceThree->setSchedulingPolicy(schedulingPolicy);
     sequencer->addService(std::move(serviceThree));
   }
   else if (realTimeSettings->outputType() == MUTED)
@@ -354,6 +401,7 @@ void runSequencer(std::shared_ptr<RealTimeSettings> realTimeSettings)
   else if (realTimeSettings->outputType() == LED)
   {
     auto serviceThree = std::make_unique<LEDBlinker>("3", 200, maxPriority, SERVICES_CORE, loggerFactory, serviceConfig);
+    serviceThree->setSchedulingPolicy(schedulingPolicy);
     sequencer->addService(std::move(serviceThree));
   }
   else
@@ -361,11 +409,23 @@ void runSequencer(std::shared_ptr<RealTimeSettings> realTimeSettings)
     throw std::runtime_error("not yet supported - to be implemented");
   }
 
-  auto serviceFour = std::make_unique<LogsToFileService>("4", 200, minPriority, SERVICES_CORE, loggerFactory, serviceConfig);
-  sequencer->addService(std::move(serviceFour));
+  if (realTimeSettings->traceEnabled() && !tracing::startDrain(TRACE_FILE))
+  {
+    std::cerr << "Could not open " << TRACE_FILE << ", tracing disabled" << std::endl;
+  }
+
+  // live statistics for rtstat
+  TelemetryPublisher telemetry([sequencer](TelemetrySegment &segment) { sequencer->fillTelemetry(segment); });
+  if (!telemetry.start())
+  {
+    std::cerr << "Could not create the telemetry segment " << TELEMETRY_SHM_NAME << std::endl;
+  }
 
   sequencer->startServices(keepRunning);
   sequencer->stopServices(true);
+  telemetry.stop();
+  tracing::stopDrain();
+  loggerFactory->stopDrain();
 
   delete sequencer;
 
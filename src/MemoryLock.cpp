@@ -0,0 +1,67 @@
+/**
+ * @file MemoryLock.cpp
+ */
+
+#include "MemoryLock.hpp"
+
+#include <alloca.h>
+#include <cerrno>
+#include <cstring>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+int rt::lockAllMemory()
+{
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+  {
+    return errno;
+  }
+  return 0;
+}
+
+void rt::disableMallocTrimming()
+{
+  mallopt(M_TRIM_THRESHOLD, -1);
+  mallopt(M_MMAP_MAX, 0);
+}
+
+// noinline so the alloca'd range really lies below the caller's frame
+__attribute__((noinline)) void rt::prefaultStack(size_t bytes)
+{
+  volatile unsigned char *stack = static_cast<volatile unsigned char *>(alloca(bytes));
+  size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+  for (size_t i = 0; i < bytes; i += page)
+  {
+    stack[i] = 0;
+  }
+}
+
+void rt::prefault(void *buffer, size_t bytes)
+{
+  volatile unsigned char *bytesPtr = static_cast<volatile unsigned char *>(buffer);
+  size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+  for (size_t i = 0; i < bytes; i += page)
+  {
+    bytesPtr[i] = bytesPtr[i];
+  }
+  if (bytes > 0)
+  {
+    bytesPtr[bytes - 1] = bytesPtr[bytes - 1];
+  }
+}
+
+rt::PageFaults rt::threadPageFaults()
+{
+  rusage usage;
+  std::memset(&usage, 0, sizeof(usage));
+  getrusage(RUSAGE_THREAD, &usage);
+
+  PageFaults faults;
+  faults.minor = usage.ru_minflt;
+  faults.major = usage.ru_majflt;
+  return faults;
+}
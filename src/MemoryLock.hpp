@@ -0,0 +1,46 @@
+/**
+ * @file MemoryLock.hpp
+ * @brief Startup memory hardening so the real-time threads don't page fault once running.
+ */
+#pragma once
+
+#include <cstddef>
+
+// how much of each real-time thread's stack to touch up front
+#define PREFAULT_STACK_BYTES (256 * 1024)
+
+namespace rt
+{
+  struct PageFaults
+  {
+    long minor = 0;
+    long major = 0;
+  };
+
+  /**
+   * @brief mlockall(MCL_CURRENT | MCL_FUTURE). Later mappings are locked and populated as they are made.
+   * @return 0 on success, otherwise errno.
+   */
+  int lockAllMemory();
+
+  /**
+   * @brief Stop glibc from returning freed memory to the kernel or serving allocations from fresh
+   * mmaps, either of which would fault again on the next touch.
+   */
+  void disableMallocTrimming();
+
+  /**
+   * @brief Touch the next bytes of the calling thread's stack.
+   */
+  void prefaultStack(size_t bytes = PREFAULT_STACK_BYTES);
+
+  /**
+   * @brief Write every page of a buffer that has not been touched yet. Contents are preserved.
+   */
+  void prefault(void *buffer, size_t bytes);
+
+  /**
+   * @brief Page faults taken by the calling thread so far.
+   */
+  PageFaults threadPageFaults();
+}
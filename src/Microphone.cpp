@@ -9,6 +9,8 @@
 
 #include <memory>
 #include <alsa/asoundlib.h>
+#include <poll.h>
+#include <vector>
 #include <string>
 #include <iostream>
 #include <exception>
@@ -21,13 +23,15 @@ int             bits = 16;
 class ALSAUSBMicrophone : public Microphone
 {
 public:
-  ALSAUSBMicrophone(std::shared_ptr<logger::LoggerFactory> loggerFactory, std::shared_ptr<AudioBuffer> audioBuffer, std::string deviceName)
+  ALSAUSBMicrophone(std::shared_ptr<logger::LoggerFactory> loggerFactory, std::shared_ptr<AudioBuffer> audioBuffer, std::string deviceName, Mic::CaptureMode captureMode)
   {
     _logger = loggerFactory->createLogger("ALSAUSBMicrophone");
+    _captureMode = captureMode;
 
     desiredChannels = audioBuffer->getNumberOfChannels();
 
     _audioBuffer = audioBuffer;
+    buffer_size = audioBuffer->getBufferSize();
 
     int err;
     if ((err = snd_pcm_open(&_handle, deviceName.c_str(), SND_PCM_STREAM_CAPTURE, SND_PCM_NONBLOCK)) < 0) {
@@ -35,7 +39,7 @@ public:
         exit(EXIT_FAILURE);
     }
 
-    if (configure_alsa_audio(desiredChannels) != 0)
+    if (configure_alsa_audio(desiredChannels) != 0 || configure_poll() != 0)
     {
       _logger->log(logger::ERROR, "Failed to configure ALSA audio");
       initialized = false;
@@ -61,35 +65,265 @@ public:
       snd_pcm_hw_params_free(_hwParams);
       _hwParams = nullptr;
     }
+
+    if (_swParams)
+    {
+      snd_pcm_sw_params_free(_swParams);
+      _swParams = nullptr;
+    }
   }
 
   int GetFrames(std::shared_ptr<AudioBuffer> buffer) override
   {
-    snd_pcm_uframes_t frames;
-    int dir;
+    if (_captureMode == Mic::CAPTURE_MMAP)
+    {
+      return _getFramesMmap(buffer);
+    }
+
+    return _getFramesRead(buffer);
+  }
+
+  int WaitForFrames(int timeoutMs) override
+  {
+    int err;
+
+    if (snd_pcm_state(_handle) == SND_PCM_STATE_PREPARED)
+    {
+      if ((err = snd_pcm_start(_handle)) < 0)
+      {
+        _logger->logFormat(logger::ERROR, "cannot start capture: %s", snd_strerror(err));
+        return Mic::MIC_ERROR;
+      }
+    }
+
+    // mmap views that are still held count towards avail, so wake only once a new period is on top of them
+    snd_pcm_uframes_t held = (_mmapOutstanding - _mmapStale) * _periodFrames;
+    if ((err = _setAvailMin(held + _periodFrames)) < 0)
+    {
+      return err;
+    }
+
+    err = poll(_pollFds.data(), _pollFds.size(), timeoutMs);
+    if (err == 0)
+    {
+      return 0;
+    }
+    else if (err < 0)
+    {
+      if (errno == EINTR)
+      {
+        return 0;
+      }
+      _logger->log(logger::ERROR, "poll on capture device failed");
+      return Mic::MIC_ERROR;
+    }
+
+    unsigned short revents;
+    snd_pcm_poll_descriptors_revents(_handle, _pollFds.data(), _pollFds.size(), &revents);
+
+    if (revents & POLLERR)
+    {
+      _logger->log(logger::ERROR, "overrun occurred");
+      if (_captureMode == Mic::CAPTURE_MMAP)
+      {
+        _recoverMmap();
+      }
+      else
+      {
+        snd_pcm_prepare(_handle);
+      }
+      return Mic::MIC_BUFFER_OVERRUN;
+    }
+
+    return (revents & POLLIN) ? 1 : 0;
+  }
+
+private:
+
+  int _setAvailMin(snd_pcm_uframes_t frames)
+  {
+    if (frames == _availMin)
+    {
+      return Mic::MIC_OK;
+    }
+
+    int err;
+    if ((err = snd_pcm_sw_params_set_avail_min(_handle, _swParams, frames)) < 0 || (err = snd_pcm_sw_params(_handle, _swParams)) < 0)
+    {
+      _logger->logFormat(logger::ERROR, "cannot set avail_min: %s", snd_strerror(err));
+      return Mic::MIC_ERROR;
+    }
+
+    _availMin = frames;
+    return Mic::MIC_OK;
+  }
+
+  int configure_poll()
+  {
+    int err;
+
+    if ((err = snd_pcm_sw_params_malloc(&_swParams)) < 0) {
+        _logger->logFormat(logger::ERROR, "cannot allocate sw parameter structure (%s)", snd_strerror(err));
+        return 1;
+    }
+
+    if ((err = snd_pcm_sw_params_current(_handle, _swParams)) < 0) {
+        _logger->logFormat(logger::ERROR, "cannot initialize sw parameter structure (%s)", snd_strerror(err));
+        return 1;
+    }
+
+    if (_setAvailMin(_periodFrames) < 0) {
+        return 1;
+    }
+
+    int count = snd_pcm_poll_descriptors_count(_handle);
+    if (count <= 0) {
+        _logger->log(logger::ERROR, "capture device has no poll descriptors");
+        return 1;
+    }
 
-    snd_pcm_hw_params_get_period_size(_hwParams, &frames, &dir);
+    _pollFds.resize(count);
+    if ((err = snd_pcm_poll_descriptors(_handle, _pollFds.data(), count)) < 0) {
+        _logger->logFormat(logger::ERROR, "cannot get poll descriptors: %s", snd_strerror(err));
+        return 1;
+    }
 
+    return 0;
+  }
+
+  int _getFramesRead(std::shared_ptr<AudioBuffer> buffer)
+  {
     int err;
     auto dataBuffer = buffer->getWriteBuffer();
 
-    err = snd_pcm_readi(_handle, dataBuffer, frames);
-    if (err == -EPIPE) {
+    err = snd_pcm_readi(_handle, dataBuffer, _periodFrames);
+    if (err == -EAGAIN || err == 0) {
+        return Mic::MIC_NOT_READY;
+    } else if (err == -EPIPE) {
         _logger->log(logger::ERROR, "overrun occurred"); 
         snd_pcm_prepare(_handle);
-        return -2;
+        return Mic::MIC_BUFFER_OVERRUN;
     } else if (err < 0) {
-        _logger->log(logger::ERROR, "read from audio interface failed: " + std::string(snd_strerror(err)));
-        return -1;
-    } else if (err != (int)frames) {
-        _logger->log(logger::ERROR, "short read, read " + std::to_string(err) + " frames");
+        _logger->logFormat(logger::ERROR, "read from audio interface failed: %s", snd_strerror(err));
+        return Mic::MIC_ERROR;
+    } else if (err != (int)_periodFrames) {
+        _logger->logFormat(logger::ERROR, "short read, read %d frames", static_cast<int>(err));
         return err;
     }
 
-    return 0;
+    if (!buffer->publishWriteBuffer())
+    {
+      return Mic::MIC_RING_FULL;
+    }
+
+    return Mic::MIC_OK;
   }
 
-private:
+  /**
+   * Zero-copy capture. Each full period is published to the audio ring as a pointer into the ALSA
+   * DMA area and is only committed back to ALSA once the consumer has released it, so the hardware
+   * can never overwrite a period that is still being read (it overruns instead).
+   */
+  int _getFramesMmap(std::shared_ptr<AudioBuffer> buffer)
+  {
+    int err;
+
+    if (snd_pcm_state(_handle) == SND_PCM_STATE_PREPARED)
+    {
+      if ((err = snd_pcm_start(_handle)) < 0)
+      {
+        _logger->logFormat(logger::ERROR, "cannot start capture: %s", snd_strerror(err));
+        return Mic::MIC_ERROR;
+      }
+    }
+
+    if ((err = _commitReleasedPeriods(buffer)) < 0)
+    {
+      return err;
+    }
+
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(_handle);
+    if (avail == -EPIPE) {
+        _logger->log(logger::ERROR, "overrun occurred");
+        _recoverMmap();
+        return Mic::MIC_BUFFER_OVERRUN;
+    } else if (avail < 0) {
+        _logger->logFormat(logger::ERROR, "avail update failed: %s", snd_strerror(avail));
+        return Mic::MIC_ERROR;
+    }
+
+    // frames already handed out as views are still counted as available by ALSA
+    snd_pcm_uframes_t held = (_mmapOutstanding - _mmapStale) * _periodFrames;
+    if (static_cast<snd_pcm_uframes_t>(avail) < held + _periodFrames) {
+        return Mic::MIC_NOT_READY;
+    }
+
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset;
+    snd_pcm_uframes_t frames = _periodFrames;
+    if ((err = snd_pcm_mmap_begin(_handle, &areas, &offset, &frames)) < 0) {
+        _logger->logFormat(logger::ERROR, "mmap begin failed: %s", snd_strerror(err));
+        return Mic::MIC_ERROR;
+    }
+    snd_pcm_mmap_commit(_handle, offset, 0);
+
+    snd_pcm_uframes_t periodOffset = (offset + held) % _bufferFrames;
+    const char *view = static_cast<const char *>(areas[0].addr) + areas[0].first / 8 + periodOffset * _frameBytes;
+
+    if (!buffer->publishWriteBuffer(view))
+    {
+      return Mic::MIC_RING_FULL;
+    }
+
+    _mmapOutstanding++;
+    return Mic::MIC_OK;
+  }
+
+  /// Commit periods the consumer has released since the last call, oldest first.
+  int _commitReleasedPeriods(std::shared_ptr<AudioBuffer> buffer)
+  {
+    size_t released = _mmapOutstanding - buffer->pending();
+
+    for (size_t i = 0; i < released; i++)
+    {
+      _mmapOutstanding--;
+
+      // views handed out before an overrun point at frames ALSA already discarded
+      if (_mmapStale > 0)
+      {
+        _mmapStale--;
+        continue;
+      }
+
+      const snd_pcm_channel_area_t *areas;
+      snd_pcm_uframes_t offset;
+      snd_pcm_uframes_t frames = _periodFrames;
+      int err;
+      if ((err = snd_pcm_mmap_begin(_handle, &areas, &offset, &frames)) < 0) {
+          _logger->logFormat(logger::ERROR, "mmap begin failed: %s", snd_strerror(err));
+          return Mic::MIC_ERROR;
+      }
+
+      snd_pcm_sframes_t committed = snd_pcm_mmap_commit(_handle, offset, frames);
+      if (committed == -EPIPE) {
+          _logger->log(logger::ERROR, "overrun occurred");
+          _recoverMmap();
+          return Mic::MIC_BUFFER_OVERRUN;
+      } else if (committed < 0 || static_cast<snd_pcm_uframes_t>(committed) != frames) {
+          _logger->log(logger::ERROR, "mmap commit failed");
+          return Mic::MIC_ERROR;
+      }
+    }
+
+    return Mic::MIC_OK;
+  }
+
+  void _recoverMmap()
+  {
+    _mmapStale = _mmapOutstanding;
+    snd_pcm_prepare(_handle);
+    snd_pcm_start(_handle);
+  }
 
   int configure_alsa_audio(unsigned int channels)
   {
@@ -100,48 +334,49 @@ private:
 
     /* allocate memory for hardware parameter structure */ 
     if ((err = snd_pcm_hw_params_malloc(&_hwParams)) < 0) {
-        _logger->log(logger::ERROR, "cannot allocate parameter structure (" + std::string(snd_strerror(err)) + ")");
+        _logger->logFormat(logger::ERROR, "cannot allocate parameter structure (%s)", snd_strerror(err));
         return 1;
     }
     /* fill structure from current audio parameters */
     if ((err = snd_pcm_hw_params_any(_handle, _hwParams)) < 0) {
-        _logger->log(logger::ERROR, "cannot initialize parameter structure (" + std::string(snd_strerror(err)) + ")");
+        _logger->logFormat(logger::ERROR, "cannot initialize parameter structure (%s)", snd_strerror(err));
         return 1;
     }
 
     /* set access type, sample rate, sample format, channels */
-    if ((err = snd_pcm_hw_params_set_access(_handle, _hwParams, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
-        _logger->log(logger::ERROR, "cannot set access type: " + std::string(snd_strerror(err)));
+    snd_pcm_access_t access = _captureMode == Mic::CAPTURE_MMAP ? SND_PCM_ACCESS_MMAP_INTERLEAVED : SND_PCM_ACCESS_RW_INTERLEAVED;
+    if ((err = snd_pcm_hw_params_set_access(_handle, _hwParams, access)) < 0) {
+        _logger->logFormat(logger::ERROR, "cannot set access type: %s", snd_strerror(err));
         return 1;
     }
 
     // bits = 16
     if ((err = snd_pcm_hw_params_set_format(_handle, _hwParams, SND_PCM_FORMAT_S16_LE)) < 0) {
-        _logger->log(logger::ERROR, "cannot set sample format: " + std::string(snd_strerror(err)));
+        _logger->logFormat(logger::ERROR, "cannot set sample format: %s", snd_strerror(err));
         return 1;
     }
     
     unsigned int sampleRate = sample_rate;
     if ((err = snd_pcm_hw_params_set_rate_near(_handle, _hwParams, &sampleRate, 0)) < 0) {
-        _logger->log(logger::ERROR, "cannot set sample rate: " + std::string(snd_strerror(err)));
+        _logger->logFormat(logger::ERROR, "cannot set sample rate: %s", snd_strerror(err));
         return 1;
     }
 
     if (sampleRate != sample_rate) {
-        _logger->log(logger::ERROR, "Could not set requested sample rate, asked for " + std::to_string(sample_rate) + " got " + std::to_string(sampleRate));
+        _logger->logFormat(logger::ERROR, "Could not set requested sample rate, asked for %u got %u", sample_rate, sampleRate);
         sample_rate = tmp;
     }
 
     alsaChannels = channels;
     int res = snd_pcm_hw_params_set_channels_near(_handle, _hwParams, &alsaChannels);
     if (res < 0) {
-      _logger->log(logger::ERROR, "cannot set channel count: " + std::string(snd_strerror(err)));
+      _logger->logFormat(logger::ERROR, "cannot set channel count: %s", snd_strerror(res));
       return 1;
     }
 
     if (channels != alsaChannels)
     {
-      _logger->log(logger::WARNING, "Could not set requested number of channels, asked for " + std::to_string(channels) + " got " + std::to_string(alsaChannels));
+      _logger->logFormat(logger::WARNING, "Could not set requested number of channels, asked for %u got %u", channels, alsaChannels);
 
       buffer_size = buffer_size / channels * alsaChannels;
 
@@ -149,10 +384,16 @@ private:
       _audioBuffer->setNumberOfChannels(alsaChannels);
     }
 
-    _logger->log(logger::INFO, "Number of channels: " + std::to_string(alsaChannels));
+    _logger->logFormat(logger::INFO, "Number of channels: %u", alsaChannels);
+
+    if (_captureMode == Mic::CAPTURE_MMAP)
+    {
+      // every slot of the audio ring may hold a period of the DMA area
+      fragments = _audioBuffer->getNumberOfSlots();
+    }
     
     if ((err = snd_pcm_hw_params_set_periods_near(_handle, _hwParams, &fragments, 0)) < 0) {
-      _logger->log(logger::ERROR, "Error setting # fragments to " + std::to_string(fragments) + ": " + std::string(snd_strerror(err)));
+      _logger->logFormat(logger::ERROR, "Error setting # fragments to %u: %s", fragments, snd_strerror(err));
       return 1;
     }
 
@@ -160,32 +401,64 @@ private:
     frames = buffer_size / frame_size * fragments; // want this to be ~480 frames for 10ms
 
     if ((err = snd_pcm_hw_params_set_buffer_size_near(_handle, _hwParams, &frames)) < 0) {
-        _logger->log(logger::ERROR, "Error setting buffer_size " + std::to_string(frames) + " frames: " + std::string(snd_strerror(err)));
+        _logger->logFormat(logger::ERROR, "Error setting buffer_size %lu frames: %s", static_cast<unsigned long>(frames), snd_strerror(err));
       return 1;
     }
 
     if (buffer_size != static_cast<int>(frames * frame_size / fragments)) {
-        _logger->log(logger::ERROR, "Could not set requested buffer size, asked for " + std::to_string(buffer_size) + " got " + std::to_string(frames * frame_size / fragments));
+        _logger->logFormat(logger::ERROR, "Could not set requested buffer size, asked for %u got %lu", buffer_size, static_cast<unsigned long>(frames * frame_size / fragments));
         buffer_size = frames * frame_size / fragments;
     }
 
     if ((err = snd_pcm_hw_params(_handle, _hwParams)) < 0) {
-      _logger->log(logger::ERROR, "Error setting HW params: " + std::string(snd_strerror(err)));
+      _logger->logFormat(logger::ERROR, "Error setting HW params: %s", snd_strerror(err));
+      return 1;
+    }
+
+    // cache period geometry so the capture path never queries hw params
+    int dir;
+    snd_pcm_hw_params_get_period_size(_hwParams, &_periodFrames, &dir);
+    snd_pcm_hw_params_get_buffer_size(_hwParams, &_bufferFrames);
+    _frameBytes = frame_size;
+
+    if (_periodFrames * _frameBytes != _audioBuffer->getBufferSize())
+    {
+      _logger->logFormat(logger::WARNING, "Resizing audio buffer to period of %lu frames", static_cast<unsigned long>(_periodFrames));
+      _audioBuffer->resizeBuffer(_periodFrames * _frameBytes);
+    }
+
+    if (_captureMode == Mic::CAPTURE_MMAP && _bufferFrames % _periodFrames != 0)
+    {
+      _logger->log(logger::ERROR, "mmap capture needs the ALSA buffer to be a whole number of periods");
       return 1;
     }
+
     return 0;
   }
 
   logger::Logger *_logger;
   snd_pcm_t *_handle;
-  snd_pcm_hw_params_t *_hwParams;
+  snd_pcm_hw_params_t *_hwParams = nullptr;
+  snd_pcm_sw_params_t *_swParams = nullptr;
+  snd_pcm_uframes_t _availMin = 0;
+  std::vector<struct pollfd> _pollFds;
   unsigned int alsaChannels;
   unsigned int desiredChannels;
-  unsigned int buffer_size = 1920;  // tuned for 2 channels, might need to update this elsewhere
+  unsigned int buffer_size;  // bytes per period, starts at the audio buffer's slot size
+  Mic::CaptureMode _captureMode;
+
+  // period geometry, cached at configure time
+  snd_pcm_uframes_t _periodFrames = 0;
+  snd_pcm_uframes_t _bufferFrames = 0;
+  unsigned int _frameBytes = 0;
+
+  // mmap capture bookkeeping
+  size_t _mmapOutstanding = 0;
+  size_t _mmapStale = 0;
   std::shared_ptr<AudioBuffer> _audioBuffer;
 };
 
-std::shared_ptr<Microphone> MicrophoneFactory::createMicrophone(std::shared_ptr<AudioBuffer> audioBuffer, std::string deviceName)
+std::shared_ptr<Microphone> MicrophoneFactory::createMicrophone(std::shared_ptr<AudioBuffer> audioBuffer, std::string deviceName, Mic::CaptureMode captureMode)
 {
-  return std::make_shared<ALSAUSBMicrophone>(this->_loggerFactory, audioBuffer, deviceName);
+  return std::make_shared<ALSAUSBMicrophone>(this->_loggerFactory, audioBuffer, deviceName, captureMode);
 }
@@ -4,6 +4,7 @@
  * ALSA implementation
  */
 #pragma once
+#include "AudioBuffer.hpp"
 #include "Logger.hpp"
 
 namespace Mic {
@@ -12,6 +13,14 @@ namespace Mic {
     MIC_OK = 0,
     MIC_ERROR = -1,
     MIC_BUFFER_OVERRUN = -2,
+    MIC_RING_FULL = -3,
+    MIC_NOT_READY = -4, // no full period captured yet, nothing was published
+  };
+
+  enum CaptureMode
+  {
+    CAPTURE_READ,   // snd_pcm_readi copies each period into the audio ring
+    CAPTURE_MMAP,   // periods are published as views straight into the ALSA DMA area
   };
 };
 
@@ -21,8 +30,18 @@ public:
   Microphone() = default;
   ~Microphone() = default;
 
+  /**
+   * @brief Capture one period and publish it to the audio ring.
+   * @return 0 only when a full period was published, a positive frame count on a short read, or a Mic::Error.
+   */
   virtual int GetFrames(std::shared_ptr<AudioBuffer> buffer) = 0;
 
+  /**
+   * @brief Block until a full period can be captured without waiting.
+   * @return 1 when a period is ready, 0 on timeout, or a Mic::Error.
+   */
+  virtual int WaitForFrames(int timeoutMs) = 0;
+
 protected:
   bool initialized = false;
 };
@@ -39,7 +58,7 @@ public:
   {
   }
 
-  std::shared_ptr<Microphone> createMicrophone(std::shared_ptr<AudioBuffer> audioBuffer, std::string deviceName);
+  std::shared_ptr<Microphone> createMicrophone(std::shared_ptr<AudioBuffer> audioBuffer, std::string deviceName, Mic::CaptureMode captureMode = Mic::CAPTURE_READ);
 
 private:
   std::shared_ptr<logger::LoggerFactory> _loggerFactory;
@@ -1,15 +1,23 @@
 
 #include "RealTime.hpp"
+#include "MemoryLock.hpp"
 
 #include <iostream>
 #include <csignal>
 #include <fstream>
 #include <sstream>
 #include <exception>
+#include <cstring>
+#include <initializer_list>
+#include <utility>
 
 #define GENERIC_ERROR 1
 #define COULD_NOT_OPEN_BOOT_OPTIONS "Could not open boot options"
 #define MUST_RUN_AS_ROOT "Must run as root"
+#define USAGE "Usage: real_time <sleep|isr|absolute|timerfd|hybrid> <terminal|led|muted> <syslog|file|terminal>\n" \
+              "                 [--capture=read|mmap] [--release=clocked|event] [--sched=fifo|deadline]\n" \
+              "                 [--executive=threaded|cyclic] [--trace=off|on] [--engine=auto|fftw|goertzel|sliding]\n" \
+              "                 [--stft=off|on] [--malloc-trim=off|on] [--schedulability=warn|refuse] [--wcet=last|none]"
 
 struct Option
 {
@@ -30,8 +38,8 @@ struct Flag
 class RealTimeSettingsImpl : public RealTimeSettings
 {
 public:
-  RealTimeSettingsImpl(SequencerType type, OutputType oType, std::shared_ptr<logger::LoggerFactory> factory):
-    RealTimeSettings(type, oType, factory)
+  RealTimeSettingsImpl(SequencerType type, OutputType oType, Mic::CaptureMode captureMode, bool eventDrivenCapture, SchedulingPolicy schedulingPolicy, bool cyclicExecutive, bool traceEnabled, FFTEngine fftEngine, bool stftEnabled, bool mallocTrimmingDisabled, SchedulabilityPolicy schedulabilityPolicy, bool wcetFromLastRun, std::shared_ptr<logger::LoggerFactory> factory):
+    RealTimeSettings(type, oType, captureMode, eventDrivenCapture, schedulingPolicy, cyclicExecutive, traceEnabled, fftEngine, stftEnabled, mallocTrimmingDisabled, schedulabilityPolicy, wcetFromLastRun, factory)
   {
     _logger = factory->createLogger("RealTimeSettingsImpl");
   }
@@ -45,6 +53,7 @@ public:
   {
     checkSudo();
     checkBootSettings();
+    hardenMemory();
   }
 
   Sequencer *createSequencer(uint16_t period, uint8_t priority, uint8_t affinity) override
@@ -62,6 +71,18 @@ public:
     {
       return _factory->createISRSequencer(period, priority, affinity);
     }
+    else if (_sequencerType == SEQUENCER_ABSOLUTE)
+    {
+      return _factory->createAbsoluteSequencer(period, priority, affinity);
+    }
+    else if (_sequencerType == SEQUENCER_TIMERFD)
+    {
+      return _factory->createTimerFDSequencer(period, priority, affinity);
+    }
+    else if (_sequencerType == SEQUENCER_HYBRID)
+    {
+      return _factory->createHybridSequencer(period, priority, affinity);
+    }
     else
     {
       throw std::invalid_argument("Invalid sequencer type");
@@ -71,6 +92,23 @@ public:
 private:
   logger::Logger *_logger;
 
+  void hardenMemory()
+  {
+    if (mallocTrimmingDisabled())
+    {
+      rt::disableMallocTrimming();
+    }
+
+    int err = rt::lockAllMemory();
+    if (err != 0)
+    {
+      _logger->logFormat(logger::ERROR, "mlockall failed, real-time threads may page fault: %s", strerror(err));
+    }
+
+    // the sequencer runs on this thread; service threads prefault their own stacks
+    rt::prefaultStack();
+  }
+
   void checkSudo()
   {
     if (getuid() != 0)
@@ -191,18 +229,35 @@ private:
     // print error
     if (error.size() != 0)
     {
-      std::stringstream cerr;
-      cerr << "WARNING - flags not present: " << error;
-      _logger->log(logger::INFO, cerr.str());
+      _logger->logFormat(logger::INFO, "WARNING - flags not present: %s", error.c_str());
     }
   }
 };
 
+/**
+ * @brief Map the value of a named option onto one of its choices, or exit with the usage.
+ */
+template <typename T>
+static T parseChoice(const std::string &name, const std::string &value, std::initializer_list<std::pair<const char *, T>> choices)
+{
+  for (const auto &[choice, result] : choices)
+  {
+    if (value == choice)
+    {
+      return result;
+    }
+  }
+
+  std::cerr << "Invalid value for --" << name << ": " << value << std::endl;
+  std::cerr << USAGE << std::endl;
+  exit(1);
+}
+
 std::shared_ptr<RealTimeSettings> SettingsParser::parseSettings()
 {
-  if (_argc != 4)
+  if (_argc < 4)
   {
-    std::cerr << "Usage: real_time <sleep|isr> <terminal|led|muted> <syslog|file|terminal>" << std::endl;
+    std::cerr << USAGE << std::endl;
     exit(1);
   }
 
@@ -216,6 +271,18 @@ std::shared_ptr<RealTimeSettings> SettingsParser::parseSettings()
   {
     sequencerType = SEQUENCER_ISR;
   }
+  else if (option == "absolute")
+  {
+    sequencerType = SEQUENCER_ABSOLUTE;
+  }
+  else if (option == "timerfd")
+  {
+    sequencerType = SEQUENCER_TIMERFD;
+  }
+  else if (option == "hybrid")
+  {
+    sequencerType = SEQUENCER_HYBRID;
+  }
   else
   {
     std::cerr << "Invalid option: " << option << std::endl;
@@ -263,8 +330,82 @@ std::shared_ptr<RealTimeSettings> SettingsParser::parseSettings()
     exit(1);
   }
 
+  Mic::CaptureMode captureMode = Mic::CAPTURE_READ;
+  bool eventDrivenCapture = false;
+  SchedulingPolicy schedulingPolicy = SCHEDULING_FIFO;
+  bool cyclicExecutive = false;
+  bool traceEnabled = false;
+  FFTEngine fftEngine = ENGINE_AUTO;
+  bool stftEnabled = false;
+  bool mallocTrimmingDisabled = true;
+  SchedulabilityPolicy schedulabilityPolicy = SCHEDULABILITY_WARN;
+  bool wcetFromLastRun = true;
+
+  // everything after the three positional arguments is an optional --name=value
+  for (int i = 4; i < _argc; i++)
+  {
+    std::string argument = _argv[i];
+    auto equals = argument.find('=');
+    if (argument.rfind("--", 0) != 0 || equals == std::string::npos)
+    {
+      std::cerr << "Invalid option: " << argument << std::endl;
+      std::cerr << USAGE << std::endl;
+      exit(1);
+    }
+
+    std::string name = argument.substr(2, equals - 2);
+    std::string value = argument.substr(equals + 1);
+
+    if (name == "capture")
+    {
+      captureMode = parseChoice<Mic::CaptureMode>(name, value, {{"read", Mic::CAPTURE_READ}, {"mmap", Mic::CAPTURE_MMAP}});
+    }
+    else if (name == "release")
+    {
+      eventDrivenCapture = parseChoice<bool>(name, value, {{"clocked", false}, {"event", true}});
+    }
+    else if (name == "sched")
+    {
+      schedulingPolicy = parseChoice<SchedulingPolicy>(name, value, {{"fifo", SCHEDULING_FIFO}, {"deadline", SCHEDULING_DEADLINE}});
+    }
+    else if (name == "executive")
+    {
+      cyclicExecutive = parseChoice<bool>(name, value, {{"threaded", false}, {"cyclic", true}});
+    }
+    else if (name == "trace")
+    {
+      traceEnabled = parseChoice<bool>(name, value, {{"off", false}, {"on", true}});
+    }
+    else if (name == "engine")
+    {
+      fftEngine = parseChoice<FFTEngine>(name, value, {{"auto", ENGINE_AUTO}, {"fftw", ENGINE_FFTW}, {"goertzel", ENGINE_GOERTZEL}, {"sliding", ENGINE_SLIDING_DFT}});
+    }
+    else if (name == "stft")
+    {
+      stftEnabled = parseChoice<bool>(name, value, {{"off", false}, {"on", true}});
+    }
+    else if (name == "malloc-trim")
+    {
+      mallocTrimmingDisabled = parseChoice<bool>(name, value, {{"off", true}, {"on", false}});
+    }
+    else if (name == "schedulability")
+    {
+      schedulabilityPolicy = parseChoice<SchedulabilityPolicy>(name, value, {{"warn", SCHEDULABILITY_WARN}, {"refuse", SCHEDULABILITY_REFUSE}});
+    }
+    else if (name == "wcet")
+    {
+      wcetFromLastRun = parseChoice<bool>(name, value, {{"last", true}, {"none", false}});
+    }
+    else
+    {
+      std::cerr << "Unknown option: --" << name << std::endl;
+      std::cerr << USAGE << std::endl;
+      exit(1);
+    }
+  }
+
   auto factory = std::make_shared<logger::LoggerFactory>(loggerType, logger::LogLevel::DEBUG);
-  std::shared_ptr<RealTimeSettings> settings = std::make_shared<RealTimeSettingsImpl>(sequencerType, oType, factory);
+  std::shared_ptr<RealTimeSettings> settings = std::make_shared<RealTimeSettingsImpl>(sequencerType, oType, captureMode, eventDrivenCapture, schedulingPolicy, cyclicExecutive, traceEnabled, fftEngine, stftEnabled, mallocTrimmingDisabled, schedulabilityPolicy, wcetFromLastRun, factory);
 
   return settings;
 }
\ No newline at end of file
@@ -5,6 +5,8 @@
 #pragma once
 
 #include "Sequencer.hpp"
+#include "Microphone.hpp"
+#include "FFT.hpp"
 #include "Logger.hpp"
 
 #include <memory>
@@ -12,7 +14,10 @@
 enum SequencerType
 {
   SEQUENCER_SLEEP,
-  SEQUENCER_ISR
+  SEQUENCER_ISR,
+  SEQUENCER_ABSOLUTE,
+  SEQUENCER_TIMERFD,
+  SEQUENCER_HYBRID
 };
 
 enum OutputType
@@ -25,13 +30,23 @@ enum OutputType
 class RealTimeSettings
 {
 public:
-  RealTimeSettings(SequencerType type, OutputType oType, std::shared_ptr<logger::LoggerFactory> factory):
+  RealTimeSettings(SequencerType type, OutputType oType, Mic::CaptureMode captureMode, bool eventDrivenCapture, SchedulingPolicy schedulingPolicy, bool cyclicExecutive, bool traceEnabled, FFTEngine fftEngine, bool stftEnabled, bool mallocTrimmingDisabled, SchedulabilityPolicy schedulabilityPolicy, bool wcetFromLastRun, std::shared_ptr<logger::LoggerFactory> factory):
     _sequencerType(type)
   {
     _factory = new SequencerFactory();
     _logger = factory->createLogger("RealTimeSettings");
     _loggerFactory = factory;
     _oType = oType;
+    _captureMode = captureMode;
+    _eventDrivenCapture = eventDrivenCapture;
+    _schedulingPolicy = schedulingPolicy;
+    _cyclicExecutive = cyclicExecutive;
+    _traceEnabled = traceEnabled;
+    _fftEngine = fftEngine;
+    _stftEnabled = stftEnabled;
+    _mallocTrimmingDisabled = mallocTrimmingDisabled;
+    _schedulabilityPolicy = schedulabilityPolicy;
+    _wcetFromLastRun = wcetFromLastRun;
   }
 
   ~RealTimeSettings()
@@ -53,6 +68,83 @@ public:
     return _oType;
   }
 
+  Mic::CaptureMode captureMode()
+  {
+    return _captureMode;
+  }
+
+  /**
+   * @brief Whether capture and FFT are released by audio readiness instead of the sequencer clock.
+   */
+  bool eventDrivenCapture()
+  {
+    return _eventDrivenCapture;
+  }
+
+  /**
+   * @brief Scheduling policy for the audio and output services.
+   */
+  SchedulingPolicy schedulingPolicy()
+  {
+    return _schedulingPolicy;
+  }
+
+  /**
+   * @brief Whether clock released services run inline on the sequencer from a schedule table.
+   */
+  bool cyclicExecutive()
+  {
+    return _cyclicExecutive;
+  }
+
+  /**
+   * @brief Whether releases and executions are traced to a Chrome Trace Event file.
+   */
+  bool traceEnabled()
+  {
+    return _traceEnabled;
+  }
+
+  /**
+   * @brief Spectrum engine the FFT service uses; ENGINE_AUTO benchmarks FFTW against Goertzel.
+   */
+  FFTEngine fftEngine()
+  {
+    return _fftEngine;
+  }
+
+  /**
+   * @brief Whether the FFT runs overlapping short-time frames instead of one transform per period.
+   */
+  bool stftEnabled()
+  {
+    return _stftEnabled;
+  }
+
+  /**
+   * @brief Whether glibc is kept from trimming the heap or mmapping large blocks once memory is locked.
+   */
+  bool mallocTrimmingDisabled()
+  {
+    return _mallocTrimmingDisabled;
+  }
+
+  /**
+   * @brief Whether addService only warns about, or refuses, a service set the declared WCETs make unschedulable.
+   */
+  SchedulabilityPolicy schedulabilityPolicy()
+  {
+    return _schedulabilityPolicy;
+  }
+
+  /**
+   * @brief Whether services declare the execution time max the previous run recorded in STATISTICS_FILE as their WCET.
+   */
+  bool wcetFromLastRun()
+  {
+    return _wcetFromLastRun;
+  }
+
   /**
    * @brief Check if the system is configured for real-time operation, and set any options that can be set.
    */
@@ -72,6 +164,16 @@ protected:
 private:
   logger::Logger* _logger;
   OutputType _oType;
+  Mic::CaptureMode _captureMode;
+  bool _eventDrivenCapture;
+  SchedulingPolicy _schedulingPolicy;
+  bool _cyclicExecutive;
+  bool _traceEnabled;
+  FFTEngine _fftEngine;
+  bool _stftEnabled;
+  bool _mallocTrimmingDisabled;
+  SchedulabilityPolicy _schedulabilityPolicy;
+  bool _wcetFromLastRun;
 };
 
 class SettingsParser
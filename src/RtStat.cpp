@@ -0,0 +1,198 @@
+/**
+ * @file RtStat.cpp
+ * Live monitor for the sequencer's telemetry segment, top style.
+ * Usage: rtstat [refresh_ms] [once]
+ */
+#include "Telemetry.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <ctime>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+
+#define DEFAULT_REFRESH_MS 500
+#define STALE_AFTER_MS 1000 // the publisher refreshes every TELEMETRY_PUBLISH_PERIOD_MS
+
+volatile std::sig_atomic_t keepRunning = 1;
+
+void interruptHandler(int)
+{
+  keepRunning = 0;
+}
+
+const char *releaseModeStr(uint8_t mode)
+{
+  switch (mode)
+  {
+    case 0:
+      return "clock";
+    case 1:
+      return "event";
+    case 2:
+      return "upstream";
+    default:
+      return "?";
+  }
+}
+
+uint64_t monotonicNowNs()
+{
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + static_cast<uint64_t>(now.tv_nsec);
+}
+
+void printTimings(std::ostream &out, const TelemetryTimings &t)
+{
+  out << std::setw(9) << t.averageMs << std::setw(9) << t.p50Ms << std::setw(9) << t.p99Ms
+      << std::setw(9) << t.p999Ms << std::setw(9) << t.maxMs;
+}
+
+void printHistogram(std::ostream &out, const TelemetryService &service)
+{
+  // one character per bin, scaled to the fullest bin
+  static const char levels[] = " .:-=+*#%@";
+  uint64_t peak = 0;
+  for (size_t i = 0; i < TELEMETRY_HISTOGRAM_BINS; i++)
+  {
+    peak = std::max(peak, service.executionHistogram[i]);
+  }
+
+  out << "  [";
+  for (size_t i = 0; i < TELEMETRY_HISTOGRAM_BINS; i++)
+  {
+    size_t level = peak == 0 ? 0 : static_cast<size_t>(service.executionHistogram[i] * 9 / peak);
+    out << levels[level];
+  }
+  out << "] 1us..." << (1ULL << (TELEMETRY_HISTOGRAM_BINS - 1)) / 1000 << "ms";
+}
+
+void render(const TelemetrySegment &segment)
+{
+  std::stringstream out;
+  out << std::fixed << std::setprecision(3);
+
+  double ageMs = static_cast<double>(monotonicNowNs() - segment.publishedNs) / 1e6;
+  out << "rtstat - pid " << segment.writerPid << ", published " << ageMs << "ms ago"
+      << (ageMs > STALE_AFTER_MS ? " (STALE, sequencer not running?)" : "") << "\n\n";
+
+  out << "Sequencer " << segment.sequencer.periodMs << "ms  ticks " << segment.sequencer.ticks
+      << "  missed " << segment.sequencer.missedReleases << "\n";
+  out << std::left << std::setw(24) << "release error (ms)" << std::right
+      << std::setw(9) << "avg" << std::setw(9) << "p50" << std::setw(9) << "p99" << std::setw(9) << "p99.9" << std::setw(9) << "max" << "\n";
+  out << std::left << std::setw(24) << "  sequencer" << std::right;
+  printTimings(out, segment.sequencer.releaseError);
+  out << "\n\n";
+
+  for (uint32_t i = 0; i < segment.serviceCount && i < TELEMETRY_MAX_SERVICES; i++)
+  {
+    const TelemetryService &service = segment.services[i];
+    out << service.name << "  " << service.periodMs << "ms " << releaseModeStr(service.releaseMode)
+        << "  prio " << static_cast<int>(service.priority) << "  core " << static_cast<int>(service.affinity)
+        << "  runs " << service.executions << "  ok/fail/degraded " << service.status[0] << "/" << service.status[1] << "/" << service.status[2] << "\n";
+    out << std::setprecision(1) << "  last " << service.statusWindow << " runs: ok " << service.statusRate[0] * 100.0 << "%  fail "
+        << service.statusRate[1] * 100.0 << "%  degraded " << service.statusRate[2] * 100.0 << "%\n" << std::setprecision(3);
+
+    out << std::left << std::setw(24) << "  execution (ms)" << std::right;
+    printTimings(out, service.execution);
+    out << "\n" << std::left << std::setw(24) << "  release error (ms)" << std::right;
+    printTimings(out, service.releaseError);
+    out << "\n  recent:";
+    for (uint32_t r = 0; r < service.recentCount && r < TELEMETRY_LAST_N; r++)
+    {
+      out << " " << service.recentExecutionMs[r];
+    }
+    out << "\n";
+    printHistogram(out, service);
+    out << "\n\n";
+  }
+
+  // clear the screen and home the cursor, then draw the frame in one write
+  std::cout << "\033[H\033[2J" << out.str() << std::flush;
+}
+
+int main(int argc, char *argv[])
+{
+  int refreshMs = DEFAULT_REFRESH_MS;
+  bool once = false;
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "once") == 0)
+    {
+      once = true;
+    }
+    else if (std::atoi(argv[i]) > 0)
+    {
+      refreshMs = std::atoi(argv[i]);
+    }
+    else
+    {
+      std::cout << "Usage: rtstat [refresh_ms] [once]" << std::endl;
+      exit(1);
+    }
+  }
+
+  int fd = shm_open(TELEMETRY_SHM_NAME, O_RDONLY, 0);
+  if (fd < 0)
+  {
+    std::cerr << "No telemetry segment " << TELEMETRY_SHM_NAME << ", is the sequencer running?" << std::endl;
+    exit(1);
+  }
+
+  void *mapping = mmap(nullptr, sizeof(TelemetrySegment), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+  {
+    std::cerr << "Could not map " << TELEMETRY_SHM_NAME << std::endl;
+    exit(1);
+  }
+  const TelemetrySegment *segment = static_cast<const TelemetrySegment *>(mapping);
+
+  signal(SIGINT, interruptHandler);
+
+  auto copy = std::make_unique<TelemetrySegment>();
+  while (keepRunning)
+  {
+    TelemetryRead result = readTelemetry(segment, *copy);
+    if (result == TELEMETRY_READ_INCOMPATIBLE)
+    {
+      std::cerr << "Telemetry segment is not version " << TELEMETRY_VERSION << ", rebuild rtstat" << std::endl;
+      exit(1);
+    }
+    else if (result == TELEMETRY_READ_TORN)
+    {
+      // a live writer is only part way through a publish, one that died there never finishes it
+      pid_t writer = segment->writerPid;
+      if (kill(writer, 0) != 0 && errno == ESRCH)
+      {
+        std::cerr << "Telemetry segment is stale, pid " << writer << " exited in the middle of a publish" << std::endl;
+        exit(1);
+      }
+    }
+    else
+    {
+      render(*copy);
+
+      if (once)
+      {
+        break;
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(refreshMs));
+  }
+
+  munmap(mapping, sizeof(TelemetrySegment));
+  return 0;
+}
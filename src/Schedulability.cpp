@@ -0,0 +1,96 @@
+/**
+ * @file Schedulability.cpp
+ */
+
+#include "Schedulability.hpp"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+// guards the fixed point iteration against floating point creep
+#define RTA_EPSILON_MS 1e-9
+
+static double responseTime(const std::vector<TaskTiming>& tasks, size_t index)
+{
+  const TaskTiming& task = tasks[index];
+  double response = task.wcetMs;
+
+  // R = C_i + sum over interfering tasks j of ceil(R / T_j) * C_j, iterated to a fixed point
+  while (response <= task.periodMs)
+  {
+    double next = task.wcetMs;
+    for (size_t j = 0; j < tasks.size(); j++)
+    {
+      const TaskTiming& other = tasks[j];
+      if (j == index || other.affinity != task.affinity || other.priority < task.priority)
+      {
+        continue;
+      }
+      next += std::ceil(response / other.periodMs - RTA_EPSILON_MS) * other.wcetMs;
+    }
+
+    if (next <= response + RTA_EPSILON_MS)
+    {
+      return next;
+    }
+    response = next;
+  }
+
+  return std::numeric_limits<double>::infinity();
+}
+
+SchedulabilityReport analyzeSchedulability(const std::vector<TaskTiming>& tasks)
+{
+  SchedulabilityReport report;
+
+  for (const auto& task : tasks)
+  {
+    auto core = std::find_if(report.cores.begin(), report.cores.end(), [&](const CoreUtilization& c) { return c.core == task.affinity; });
+    if (core == report.cores.end())
+    {
+      report.cores.push_back({task.affinity, 0, 0.0, 0.0});
+      core = report.cores.end() - 1;
+    }
+    core->tasks++;
+    core->utilization += task.wcetMs / task.periodMs;
+  }
+
+  for (auto& core : report.cores)
+  {
+    double n = static_cast<double>(core.tasks);
+    core.rateMonotonicBound = n * (std::pow(2.0, 1.0 / n) - 1.0);
+    if (core.utilization > 1.0)
+    {
+      report.schedulable = false;
+    }
+  }
+
+  for (size_t i = 0; i < tasks.size(); i++)
+  {
+    double response = responseTime(tasks, i);
+    bool schedulable = response <= tasks[i].periodMs;
+    report.tasks.push_back({tasks[i].name, tasks[i].affinity, tasks[i].wcetMs, response, tasks[i].periodMs, schedulable});
+    report.schedulable = report.schedulable && schedulable;
+  }
+
+  return report;
+}
+
+void printSchedulabilityReport(std::ostream& out, const SchedulabilityReport& report)
+{
+  out << "\n================================================================\n";
+  out << "Schedulability: " << (report.schedulable ? "OK" : "DEADLINES CAN BE MISSED") << "\n";
+  for (const auto& core : report.cores)
+  {
+    out << "Core " << static_cast<int>(core.core) << " Utilization: " << core.utilization * 100.0
+        << "% (RM bound " << core.rateMonotonicBound * 100.0 << "%)\n";
+  }
+  for (const auto& task : report.tasks)
+  {
+    out << "Service " << task.name << " on core " << static_cast<int>(task.affinity) << ": WCET " << task.wcetMs
+        << "ms, worst-case response " << task.responseTimeMs << "ms, deadline " << task.deadlineMs << "ms"
+        << (task.schedulable ? "" : " - CAN MISS DEADLINE") << "\n";
+  }
+  out << "================================================================\n";
+}
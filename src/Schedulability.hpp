@@ -0,0 +1,55 @@
+/**
+ * @file Schedulability.hpp
+ * @brief Fixed-priority response-time analysis for services sharing a core.
+ *
+ * Every service is treated as a periodic (or, for event released services, sporadic) task with an
+ * implicit deadline equal to its period. Tasks on the same core at an equal or higher SCHED_FIFO
+ * priority are assumed to interfere, which is pessimistic for equal priorities but safe.
+ */
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct TaskTiming
+{
+  std::string name;
+  double periodMs;
+  double wcetMs;
+  uint8_t priority;
+  uint8_t affinity;
+};
+
+struct TaskResponse
+{
+  std::string name;
+  uint8_t affinity;
+  double wcetMs;
+  double responseTimeMs; // infinity if the recurrence did not converge within the deadline
+  double deadlineMs;
+  bool schedulable;
+};
+
+struct CoreUtilization
+{
+  uint8_t core;
+  size_t tasks;
+  double utilization;
+  double rateMonotonicBound; // Liu & Layland n(2^(1/n) - 1), sufficient but not necessary
+};
+
+struct SchedulabilityReport
+{
+  std::vector<CoreUtilization> cores;
+  std::vector<TaskResponse> tasks;
+  bool schedulable = true;
+};
+
+/**
+ * @brief Run response-time analysis per core.
+ */
+SchedulabilityReport analyzeSchedulability(const std::vector<TaskTiming>& tasks);
+
+void printSchedulabilityReport(std::ostream& out, const SchedulabilityReport& report);
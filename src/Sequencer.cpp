@@ -3,14 +3,29 @@
  */
 
 #include "Sequencer.hpp"
+#include "AllocationGuard.hpp"
 #include <csignal>
 #include <chrono>
 #include <thread>
 #include <iostream>
 #include <syslog.h>
+#include <ctime>
+#include <cerrno>
+#include <sys/timerfd.h>
+#include <algorithm>
+#include <numeric>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 
 #define FATAL_ERR 1
 
+// how often the measured WCETs are re-run through the response-time analysis
+#define SCHEDULABILITY_CHECK_ITERATIONS 1000
+
 //////////////////// HELPER ////////////////////
 void setCurrentThreadAffinity(int cpu)
 {
@@ -36,53 +51,239 @@ void setCurrentThreadPriority(int priority)
     }
 }
 
+// glibc has no wrapper for sched_setattr, layout from include/uapi/linux/sched/types.h
+struct DeadlineSchedAttr
+{
+  uint32_t size;
+  uint32_t sched_policy;
+  uint64_t sched_flags;
+  int32_t sched_nice;
+  uint32_t sched_priority;
+  uint64_t sched_runtime;
+  uint64_t sched_deadline;
+  uint64_t sched_period;
+};
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+// the kernel rejects runtimes below 1024ns
+#define MIN_DEADLINE_RUNTIME_NS static_cast<uint64_t>(1024)
+#define RT_RUNTIME_FILE "/proc/sys/kernel/sched_rt_runtime_us"
+
+static int setDeadlineAttr(pid_t tid, uint64_t runtimeNs, uint64_t deadlineNs, uint64_t periodNs)
+{
+  DeadlineSchedAttr attr = {};
+  attr.size = sizeof(attr);
+  attr.sched_policy = SCHED_DEADLINE;
+  attr.sched_runtime = runtimeNs;
+  attr.sched_deadline = deadlineNs;
+  attr.sched_period = periodNs;
+
+  return syscall(SYS_sched_setattr, tid, &attr, 0) != 0 ? errno : 0;
+}
+
 //////////////////// SERVICE ////////////////////
+// faults runInline has charged to the services it ran on this thread
+static thread_local rt::PageFaults inlineChargedFaults;
+
+// faults of the calling thread less those already charged to services it ran inline
+static rt::PageFaults ownPageFaults()
+{
+  rt::PageFaults total = rt::threadPageFaults();
+  return {total.minor - inlineChargedFaults.minor, total.major - inlineChargedFaults.major};
+}
+
 void Service::_initializeService()
 {
+  _tid.store(static_cast<pid_t>(syscall(SYS_gettid)));
   setCurrentThreadAffinity(_affinity);
   setCurrentThreadPriority(_priority); 
+  rt::prefaultStack();
+  tracing::registerThread(_serviceName);
+  logger::registerThread();
   _running.store(true);
 }
 
+int Service::applyDeadlineScheduling(uint64_t runtimeNs, uint64_t deadlineNs, uint64_t periodNs)
+{
+  int err = setDeadlineAttr(_tid.load(), runtimeNs, deadlineNs, periodNs);
+  if (err != 0)
+  {
+    return err;
+  }
+
+  _logger->logFormat(logger::INFO, "Service %s running SCHED_DEADLINE runtime %lluns period %lluns", _serviceName.c_str(),
+                     static_cast<unsigned long long>(runtimeNs), static_cast<unsigned long long>(periodNs));
+  return 0;
+}
+
 void Service::_doService()
 {
-  _logger->log(logger::TRACE, "Initializing service " + _serviceName);
+  _logger->logFormat(logger::TRACE, "Initializing service %s", _serviceName.c_str());
 
   _initializeService();
 
+  if (_releaseMode == RELEASE_EVENT)
+  {
+    // armed by the first sequencer tick, once the derived service is fully constructed
+    while (_running && !_releaseService.try_acquire_for(std::chrono::milliseconds(_period * 2)));
+    _pendingReleases.fetch_sub(1, std::memory_order_relaxed);
+  }
+
   int counter = 0;
+  bool warmedUp = false;
   while (_running)
   {
-    auto acquired = _releaseService.try_acquire_for(std::chrono::milliseconds(_period * 2)); // TODO: wait for less time, so that we can check if service is still running. Add a helper method for this.
+    bool acquired;
+    if (_releaseMode == RELEASE_EVENT)
+    {
+      acquired = _waitForEvent(_period * 2);
+      if (acquired)
+      {
+        _recordRelease();
+      }
+    }
+    else
+    {
+      acquired = _releaseService.try_acquire_for(std::chrono::milliseconds(_period * 2)); // TODO: wait for less time, so that we can check if service is still running. Add a helper method for this.
+      if (acquired)
+      {
+        _pendingReleases.fetch_sub(1, std::memory_order_relaxed);
+      }
+    }
 
     if (!_running)
     {
-      _logger->log(logger::INFO, "Service exited " + _serviceName);
+      _logger->logFormat(logger::INFO, "Service exited %s", _serviceName.c_str());
       break;
     }
     
     if (!acquired)
     {
+      if (_inline.load())
+      {
+        // run from the sequencer's schedule table, nothing to wait for here
+        continue;
+      }
+
       counter++;
-      _logger->log(logger::ERROR, "Service " + _serviceName + " did not release in its 2*period: " + std::to_string(_period * 2) + "ms");
+      _logger->logFormat(logger::ERROR, "Service %s did not release in its 2*period: %dms", _serviceName.c_str(), _period * 2);
 
       if (counter > 100)
       {
-        _logger->log(logger::ERROR, "Service " + _serviceName + " has not released in 100 periods. Stopping service.");
+        _logger->logFormat(logger::ERROR, "Service %s has not released in 100 periods. Stopping service.", _serviceName.c_str());
         _running.store(false);
       }
       continue;
     }
 
-    auto start = std::chrono::high_resolution_clock::now();
+    _execute();
+
+    // the first run is allowed to warm caches, plans and lazily sized buffers
+    if (!warmedUp)
+    {
+      _startupFaults = ownPageFaults();
+      warmedUp = true;
+
+      if (_guardAllocations)
+      {
+        rt::armAllocationGuard();
+      }
+    }
+  }
 
-    ServiceStatus status = _serviceFunction();
-    _statusCounter->Add(status);
+  // teardown from here on may allocate
+  rt::disarmAllocationGuard();
 
-    auto stop = std::chrono::high_resolution_clock::now();
-    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-    _executionTimeStats.Add({static_cast<double>(elapsed.count()) / 1000.0 });
+  // a thread parked for inline runs never ran the service, all of its faults are its own startup
+  rt::PageFaults total = ownPageFaults();
+  if (!warmedUp)
+  {
+    _startupFaults = total;
   }
+  _runningFaults.minor = total.minor - _startupFaults.minor;
+  _runningFaults.major = total.major - _startupFaults.major;
+}
+
+void Service::_execute()
+{
+  tracing::record(tracing::TRACE_START, _traceSource);
+  auto start = std::chrono::high_resolution_clock::now();
+
+  ServiceStatus status = _serviceFunction();
+  _statusCounter->Add(status);
+  tracing::record(tracing::TRACE_END, _traceSource, 0, static_cast<uint8_t>(status));
+
+  auto stop = std::chrono::high_resolution_clock::now();
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+  _executionTimeStats.Add({static_cast<double>(elapsed.count()) / 1000.0 });
+
+  // a failed or degraded run has nothing new for the next stage
+  if (status == SUCCESS)
+  {
+    _releaseDownstream();
+  }
+}
+
+void Service::_releaseDownstream()
+{
+  for (Service *downstream : _downstream)
+  {
+    downstream->_upstreamCompleted();
+  }
+}
+
+void Service::_upstreamCompleted()
+{
+  if (_upstreamPending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+  {
+    return;
+  }
+  _upstreamPending.store(_upstreamCount, std::memory_order_relaxed);
+
+  // inline stages run straight after their upstream on the same thread
+  if (_inline.load())
+  {
+    runInline();
+  }
+  else
+  {
+    release();
+  }
+}
+
+void Service::runInline()
+{
+  _recordRelease();
+
+  // RUSAGE_THREAD counts for the thread, not the service, so take the caller's faults around the run
+  // and charge them here, less whatever an inline downstream released from this run charged itself
+  rt::PageFaults before = ownPageFaults();
+
+  // the thread is borrowed, so the guard covers only this run and the caller's state comes back after
+  // it. An unguarded or first run is allowed even when it runs inside a guarded upstream
+  if (_guardAllocations && _inlineWarmedUp)
+  {
+    rt::GuardAllocations guard;
+    _execute();
+  }
+  else
+  {
+    rt::AllowAllocations allow;
+    _execute();
+  }
+
+  rt::PageFaults after = ownPageFaults();
+  long minor = after.minor - before.minor;
+  long major = after.major - before.major;
+  rt::PageFaults &charged = _inlineWarmedUp ? _inlineRunningFaults : _inlineStartupFaults;
+  charged.minor += minor;
+  charged.major += major;
+  inlineChargedFaults.minor += minor;
+  inlineChargedFaults.major += major;
+  _inlineWarmedUp = true;
 }
 
 void Service::stop()
@@ -93,6 +294,23 @@ void Service::stop()
 
 void Service::release()
 {
+  _recordRelease();
+
+  // a service that is still behind keeps the releases it already has rather than overflowing the
+  // semaphore; only pipeline stages queue more than one, each matching a queued input
+  int limit = _releaseMode == RELEASE_UPSTREAM ? SERVICE_MAX_PENDING_RELEASES : 1;
+  if (_pendingReleases.fetch_add(1, std::memory_order_relaxed) >= limit)
+  {
+    _pendingReleases.fetch_sub(1, std::memory_order_relaxed);
+    return;
+  }
+  _releaseService.release();
+}
+
+void Service::_recordRelease()
+{
+  tracing::record(tracing::TRACE_RELEASE, _traceSource);
+
   if (!_serviceStarted.load())
   {
     _serviceStarted.store(true);
@@ -106,7 +324,6 @@ void Service::release()
     _releaseStats.Add({static_cast<double>(time_released - expected) / 1000.0});
   }
   _releaseNumber++;
-  _releaseService.release();
 }
 
 //////////////////// SEQUENCER MAIN ////////////////////
@@ -114,8 +331,10 @@ Sequencer::Sequencer(uint16_t period, uint8_t priority, uint8_t affinity):
   _period(period),
   _stats(StatTracker(1000))
 {
+  _traceSource = tracing::registerSource("tick");
   setCurrentThreadAffinity(affinity);
   setCurrentThreadPriority(priority);
+  rt::prefaultStack();
 }
 
 void printServiceStatistics(std::ofstream& file, std::unique_ptr<Service>& service, const std::string& name)
@@ -127,37 +346,48 @@ void printServiceStatistics(std::ofstream& file, std::unique_ptr<Service>& servi
   file << "Execution Time Average: " << executionStats.GetAverageDurationMs() << "ms\n";
   file << "Execution Time Max: " << executionStats.GetMaxVal() << "ms\n";
   file << "Execution Time Min: " << executionStats.GetMinVal() << "ms\n";
+  file << "Execution Time Max (whole run): " << executionStats.GetRunMaxVal() << "ms\n";
+  file << "Execution Time p99/p99.9 (whole run): " << executionStats.GetRunPercentile(0.99) << "/" << executionStats.GetRunPercentile(0.999) << "ms\n";
   file << "Release Time Average Error: " << releaseStats.GetAverageDurationMs() << "ms\n";
+  file << "Release Time Error p99/p99.9 (whole run): " << releaseStats.GetRunPercentile(0.99) << "/" << releaseStats.GetRunPercentile(0.999) << "ms\n";
   file << "Executions that met deadline: " << executionStats.GetNumberCompletedOnTime(service->getPeriod()) << "/" << executionStats.GetNumElements() << "\n";
-  file << "Executions that completed successfully: " << service->getStatusCounter()->GetCount(SUCCESS) << "/" << executionStats.GetNumElements() << "\n";
+  file << "Executions that completed successfully: " << service->getStatusCounter()->GetCount(SUCCESS) << "/" << service->getStatusCounter()->GetTotal() << "\n";
+  file << "Success/Failure/Degraded rate (last " << STATUS_WINDOW << "): " << service->getStatusCounter()->GetWindowRate(SUCCESS) * 100.0 << "%/"
+       << service->getStatusCounter()->GetWindowRate(FAILURE) * 100.0 << "%/" << service->getStatusCounter()->GetWindowRate(DEGRADED) * 100.0 << "%\n";
+  file << "Page Faults At Startup (minor/major): " << service->startupPageFaults().minor << "/" << service->startupPageFaults().major << "\n";
+  file << "Page Faults While Running (minor/major): " << service->runningPageFaults().minor << "/" << service->runningPageFaults().major << "\n";
   file << "================================================================\n";
 }
 
-void printSequencerStatistics(std::ofstream& file, StatTracker& stats)
+void printSequencerStatistics(std::ofstream& file, StatTracker& stats, uint64_t missedReleases, rt::PageFaults runningFaults)
 {
   file << "\n================================================================\n";
   file << "Sequencer Execution Statistics\n";
   file << "Execution Time Error Average: " << stats.GetAverageDurationMs() << "ms\n";
   file << "Execution Time Error Max: " << stats.GetMaxVal() << "ms\n";
   file << "Execution Time Error Min: " << stats.GetMinVal() << "ms\n";
+  file << "Execution Time Error p99/p99.9 (whole run): " << stats.GetRunPercentile(0.99) << "/" << stats.GetRunPercentile(0.999) << "ms\n";
+  file << "Missed Releases: " << missedReleases << "\n";
+  file << "Page Faults While Running (minor/major): " << runningFaults.minor << "/" << runningFaults.major << "\n";
   file << "================================================================\n";
 }
 
-void printStatistics(StatTracker& sequencerStats, std::vector<std::unique_ptr<Service>>& services)
+void printStatistics(StatTracker& sequencerStats, uint64_t missedReleases, rt::PageFaults sequencerFaults, std::vector<std::unique_ptr<Service>>& services, const SchedulabilityReport& schedulability)
 {
-  std::ofstream file("statistics.txt", std::ios::app);
+  std::ofstream file(STATISTICS_FILE, std::ios::app);
   if (!file.is_open())
   {
-    std::cerr << "Error opening statistics.txt for writing" << std::endl;
+    std::cerr << "Error opening " STATISTICS_FILE " for writing" << std::endl;
     return;
   }
 
-  printSequencerStatistics(file, sequencerStats);
+  printSequencerStatistics(file, sequencerStats, missedReleases, sequencerFaults);
   // Print execution statistics
   for(auto& service : services)
   {
     printServiceStatistics(file, service, service->serviceName());
   }
+  printSchedulabilityReport(file, schedulability);
   file << std::endl;
 
   file.close();
@@ -167,7 +397,17 @@ void Sequencer::startServices(std::shared_ptr<std::atomic<bool>> keepRunning)
 {
   using namespace std::chrono_literals;
 
+  // refuse up front rather than after calibration, when the services are already running
+  if (_deadlineCalibrationIterations > 0 && !_checkDeadlineSupport())
+  {
+    keepRunning->store(false);
+    return;
+  }
+
   _initializeSequencer();
+  _startupFaults = ownPageFaults();
+  tracing::registerThread("sequencer");
+  logger::registerThread();
 
   bool start_set = false;
   std::chrono::high_resolution_clock::time_point start;
@@ -177,6 +417,14 @@ void Sequencer::startServices(std::shared_ptr<std::atomic<bool>> keepRunning)
   {
     _waitForRelease();
 
+    // ticks a timer fired while we were late are accounted for instead of merged into this one
+    long first = iterations;
+    long skipped = static_cast<long>(_skippedReleases);
+    _skippedReleases = 0;
+    _missedReleases += skipped;
+    iterations += skipped;
+    tracing::record(tracing::TRACE_TICK, _traceSource, static_cast<uint32_t>(iterations));
+
     if (!start_set)
     {
       start = std::chrono::high_resolution_clock::now();
@@ -190,16 +438,139 @@ void Sequencer::startServices(std::shared_ptr<std::atomic<bool>> keepRunning)
 
     _stats.Add({msElapsed - expectedMs});
     
+    if (_cyclicExecutive)
+    {
+      _runScheduleTable(first, iterations);
+    }
+
     for(auto& service : _services)
     {
-      if (_period * iterations % service->getPeriod() == 0)
+      bool releaseDue = false;
+      if (_cyclicExecutive && service->releaseMode() == RELEASE_CLOCK)
+      {
+        // already run from the schedule table
+      }
+      else if (service->releaseMode() == RELEASE_CLOCK)
+      {
+        // a service due on a skipped tick is released late rather than dropped
+        for (long k = first; k <= iterations && !releaseDue; k++)
+        {
+          releaseDue = _period * k % service->getPeriod() == 0;
+        }
+      }
+      else if (service->releaseMode() == RELEASE_EVENT)
+      {
+        releaseDue = first == 0;
+      }
+
+      if (releaseDue)
       {
         service->release();
       }
     }
 
     iterations++;
+
+    // the analysis itself allocates, so it runs on the telemetry publisher, not here
+    if (iterations % SCHEDULABILITY_CHECK_ITERATIONS == 0)
+    {
+      _schedulabilityCheckDue.store(true, std::memory_order_relaxed);
+    }
+
+    // skipped ticks can step past the exact iteration, so admit once the count is reached
+    if (_deadlineCalibrationIterations > 0 && iterations >= _deadlineCalibrationIterations)
+    {
+      _deadlineCalibrationIterations = 0;
+      if (!_admitDeadlineServices())
+      {
+        keepRunning->store(false);
+      }
+    }
+  }
+}
+
+bool Sequencer::_checkDeadlineSupport()
+{
+  // with RT throttling off the kernel skips every SCHED_DEADLINE admission test, overload included
+  std::ifstream runtimeFile(RT_RUNTIME_FILE);
+  long rtRuntimeUs = 0;
+  if (runtimeFile >> rtRuntimeUs && rtRuntimeUs < 0)
+  {
+    std::cerr << "SCHED_DEADLINE needs the kernel's admission control, but " RT_RUNTIME_FILE " is -1. "
+              << "Run ./configure.sh --deadline to restore it." << std::endl;
+    return false;
+  }
+
+  for (auto& service : _services)
+  {
+    if (service->schedulingPolicy() != SCHEDULING_DEADLINE || service->runsInline())
+    {
+      continue;
+    }
+
+    // admission control also refuses a deadline task whose affinity is narrower than its root domain,
+    // so try the service's core from a throwaway thread with the smallest possible budget
+    int err = 0;
+    std::thread probe([&]() {
+      setCurrentThreadAffinity(service->getAffinity());
+      err = setDeadlineAttr(0, MIN_DEADLINE_RUNTIME_NS, static_cast<uint64_t>(service->getPeriod()) * 1000000ULL,
+                            static_cast<uint64_t>(service->getPeriod()) * 1000000ULL);
+    });
+    probe.join();
+
+    if (err == EPERM)
+    {
+      std::cerr << "SCHED_DEADLINE refused for " << service->serviceName() << ": the kernel only admits deadline tasks whose "
+                << "affinity covers their whole root domain, and the service is pinned to core " << static_cast<int>(service->getAffinity())
+                << ". Give that core its own cpuset partition, see ./configure.sh --deadline." << std::endl;
+      return false;
+    }
+    else if (err != 0)
+    {
+      std::cerr << "SCHED_DEADLINE unavailable for " << service->serviceName() << ": " << strerror(err) << std::endl;
+      return false;
+    }
   }
+
+  return true;
+}
+
+bool Sequencer::_admitDeadlineServices()
+{
+  for (auto& service : _services)
+  {
+    if (service->schedulingPolicy() != SCHEDULING_DEADLINE)
+    {
+      continue;
+    }
+
+    if (service->runsInline())
+    {
+      std::cerr << "Service " << service->serviceName() << " runs inline in the cyclic executive, not moving it to SCHED_DEADLINE" << std::endl;
+      continue;
+    }
+
+    auto executionStats = service->executionTimeStats();
+    if (executionStats.GetNumElements() == 0)
+    {
+      std::cerr << "Service " << service->serviceName() << " never ran during calibration, cannot size its SCHED_DEADLINE runtime" << std::endl;
+      return false;
+    }
+
+    uint64_t periodNs = static_cast<uint64_t>(service->getPeriod()) * 1000000ULL;
+    uint64_t runtimeNs = static_cast<uint64_t>(executionStats.GetRunMaxVal() * _wcetMargin * 1000000.0);
+    runtimeNs = std::clamp(runtimeNs, MIN_DEADLINE_RUNTIME_NS, periodNs);
+
+    int err = service->applyDeadlineScheduling(runtimeNs, periodNs, periodNs);
+    if (err != 0)
+    {
+      std::cerr << "SCHED_DEADLINE admission refused for " << service->serviceName() << " (runtime " << runtimeNs
+                << "ns / period " << periodNs << "ns): " << strerror(err) << std::endl;
+      return false;
+    }
+  }
+
+  return true;
 }
 
 void Sequencer::stopServices(bool statisticsToFile)
@@ -211,7 +582,254 @@ void Sequencer::stopServices(bool statisticsToFile)
 
   if (statisticsToFile)
   {
-    printStatistics(_stats, _services);
+    // stopServices runs on the sequencer thread once its loop has exited. Faults of services it ran
+    // inline are already charged to them
+    rt::PageFaults total = ownPageFaults();
+    rt::PageFaults running = {total.minor - _startupFaults.minor, total.major - _startupFaults.major};
+    printStatistics(_stats, _missedReleases.load(), running, _services, checkSchedulability(true));
+  }
+}
+
+SchedulabilityReport Sequencer::checkSchedulability(bool measured)
+{
+  std::vector<TaskTiming> tasks;
+  tasks.reserve(_services.size());
+
+  for (auto& service : _services)
+  {
+    double wcetMs = service->wcetEstimate();
+    if (measured && service->executionTimeStats().GetNumElements() > 0)
+    {
+      wcetMs = std::max(wcetMs, service->executionTimeStats().GetRunMaxVal());
+    }
+    tasks.push_back({service->serviceName(), static_cast<double>(service->getPeriod()), wcetMs, service->getPriority(), service->getAffinity()});
+  }
+
+  return analyzeSchedulability(tasks);
+}
+
+static TelemetryTimings telemetryTimings(StatTracker stats)
+{
+  return {stats.GetRunAverageMs(), stats.GetRunMaxVal(), stats.GetRunPercentile(0.5), stats.GetRunPercentile(0.99), stats.GetRunPercentile(0.999)};
+}
+
+void Sequencer::fillTelemetry(TelemetrySegment &segment)
+{
+  if (_schedulabilityCheckDue.exchange(false, std::memory_order_relaxed))
+  {
+    _checkMeasuredSchedulability();
+  }
+
+  segment.sequencer.periodMs = _period;
+  segment.sequencer.ticks = _stats.GetRunCount();
+  segment.sequencer.missedReleases = _missedReleases.load(std::memory_order_relaxed);
+  segment.sequencer.releaseError = telemetryTimings(_stats);
+
+  size_t count = std::min(_services.size(), static_cast<size_t>(TELEMETRY_MAX_SERVICES));
+  segment.serviceCount = static_cast<uint32_t>(count);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    auto &service = _services[i];
+    TelemetryService &out = segment.services[i];
+    StatTracker execution = service->executionTimeStats();
+
+    std::snprintf(out.name, sizeof(out.name), "%s", service->serviceName().c_str());
+    out.periodMs = service->getPeriod();
+    out.priority = service->getPriority();
+    out.affinity = service->getAffinity();
+    out.releaseMode = static_cast<uint8_t>(service->releaseMode());
+    out.executions = execution.GetRunCount();
+    out.statusWindow = static_cast<uint32_t>(std::min(service->getStatusCounter()->GetTotal(), static_cast<uint64_t>(STATUS_WINDOW)));
+    for (ServiceStatus status : {SUCCESS, FAILURE, DEGRADED})
+    {
+      out.status[status] = service->getStatusCounter()->GetCount(status);
+      out.statusRate[status] = service->getStatusCounter()->GetWindowRate(status);
+    }
+    out.execution = telemetryTimings(execution);
+    out.releaseError = telemetryTimings(service->releaseStats());
+    out.recentCount = static_cast<uint32_t>(execution.GetRecent(out.recentExecutionMs, TELEMETRY_LAST_N));
+
+    // power of two bins in microseconds from the cumulative counts. The service keeps recording while
+    // these are read, so the last bin uses a fresh total and every cumulative count is clamped to be
+    // non-decreasing; a bin can never go negative
+    uint64_t below = 0;
+    for (size_t bin = 0; bin < TELEMETRY_HISTOGRAM_BINS; bin++)
+    {
+      uint64_t atOrBelow = bin + 1 == TELEMETRY_HISTOGRAM_BINS ? execution.GetRunCount() : execution.GetRunCountAtOrBelow(static_cast<double>(1ULL << bin) / 1000.0);
+      atOrBelow = std::max(atOrBelow, below);
+      out.executionHistogram[bin] = atOrBelow - below;
+      below = atOrBelow;
+    }
+    out.executions = std::max(out.executions, below);
+  }
+}
+
+size_t Sequencer::loadWcetEstimates(const std::string &statisticsFile)
+{
+  std::ifstream file(statisticsFile);
+  if (!file.is_open())
+  {
+    return 0;
+  }
+
+  // every run appends its report, so a later run's max replaces an earlier one
+  const std::string servicePrefix = "Service ";
+  const std::string serviceSuffix = " Execution Statistics";
+  const std::string maxPrefix = "Execution Time Max (whole run): ";
+  std::string service;
+  std::string line;
+  while (std::getline(file, line))
+  {
+    if (line.starts_with(servicePrefix) && line.ends_with(serviceSuffix))
+    {
+      service = line.substr(servicePrefix.size(), line.size() - servicePrefix.size() - serviceSuffix.size());
+    }
+    else if (!service.empty() && line.starts_with(maxPrefix))
+    {
+      double wcetMs = std::strtod(line.c_str() + maxPrefix.size(), nullptr);
+      if (wcetMs > 0.0)
+      {
+        _wcetEstimates[service] = wcetMs;
+      }
+      service.clear();
+    }
+  }
+
+  return _wcetEstimates.size();
+}
+
+void Sequencer::_applyWcetEstimate(Service &service)
+{
+  auto estimate = _wcetEstimates.find(service.serviceName());
+  if (service.wcetEstimate() == 0.0 && estimate != _wcetEstimates.end())
+  {
+    service.setWcetEstimate(estimate->second);
+  }
+}
+
+void Sequencer::_admitService()
+{
+  auto report = checkSchedulability(false);
+  if (report.schedulable)
+  {
+    return;
+  }
+
+  printSchedulabilityReport(std::cerr, report);
+
+  if (_schedulabilityPolicy == SCHEDULABILITY_REFUSE)
+  {
+    auto& service = _services.back();
+    std::string name = service->serviceName();
+    service->stop();
+    _services.pop_back();
+    throw std::invalid_argument("Service " + name + " refused: the service set is not schedulable with the declared WCETs.");
+  }
+}
+
+void Sequencer::_checkMeasuredSchedulability()
+{
+  auto report = checkSchedulability(true);
+
+  // only report transitions; runs on the low priority telemetry publisher
+  if (!report.schedulable && _measuredSchedulable)
+  {
+    printSchedulabilityReport(std::cerr, report);
+  }
+  _measuredSchedulable = report.schedulable;
+}
+
+bool Sequencer::_reaches(Service *from, Service *to)
+{
+  if (from == to)
+  {
+    return true;
+  }
+
+  return std::any_of(from->_downstream.begin(), from->_downstream.end(), [to](Service *next) { return _reaches(next, to); });
+}
+
+void Sequencer::addDependency(Service *upstream, Service *downstream)
+{
+  auto added = [this](Service *service) {
+    return std::any_of(_services.begin(), _services.end(), [service](auto& s) { return s.get() == service; });
+  };
+
+  if (!added(upstream) || !added(downstream))
+  {
+    throw std::invalid_argument("Both services of a dependency must be added to the sequencer first.");
+  }
+
+  if (downstream->releaseMode() != RELEASE_UPSTREAM)
+  {
+    throw std::invalid_argument("Service " + downstream->serviceName() + " must be RELEASE_UPSTREAM to depend on another service.");
+  }
+
+  if (_reaches(downstream, upstream))
+  {
+    throw std::invalid_argument("Dependency " + upstream->serviceName() + " -> " + downstream->serviceName() + " would create a cycle.");
+  }
+
+  upstream->_downstream.push_back(downstream);
+  downstream->_upstreamCount++;
+  downstream->_upstreamPending.store(downstream->_upstreamCount);
+}
+
+void Sequencer::_buildScheduleTable()
+{
+  // hyperperiod in minor frames: lcm of every clock service's period, in sequencer periods
+  size_t frames = 1;
+  for (auto& service : _services)
+  {
+    if (service->releaseMode() == RELEASE_CLOCK)
+    {
+      frames = std::lcm(frames, static_cast<size_t>(service->getPeriod() / _period));
+    }
+  }
+
+  // highest priority first within a frame, ties keep the order services were added in
+  std::vector<size_t> byPriority(_services.size());
+  std::iota(byPriority.begin(), byPriority.end(), 0);
+  std::stable_sort(byPriority.begin(), byPriority.end(), [this](size_t a, size_t b) {
+    return _services[a]->getPriority() > _services[b]->getPriority();
+  });
+
+  _scheduleTable.assign(frames, {});
+  for (size_t frame = 0; frame < frames; frame++)
+  {
+    for (size_t index : byPriority)
+    {
+      auto& service = _services[index];
+      if (service->releaseMode() == RELEASE_CLOCK && _period * frame % service->getPeriod() == 0)
+      {
+        _scheduleTable[frame].push_back(index);
+      }
+    }
+  }
+
+  _ranThisTick.assign(_services.size(), false);
+  for (auto& service : _services)
+  {
+    service->setInline(_cyclicExecutive && service->releaseMode() != RELEASE_EVENT);
+  }
+}
+
+void Sequencer::_runScheduleTable(long first, long last)
+{
+  std::fill(_ranThisTick.begin(), _ranThisTick.end(), false);
+
+  // frames covered by skipped ticks are merged, each service still runs at most once per tick
+  for (long k = first; k <= last; k++)
+  {
+    for (size_t index : _scheduleTable[static_cast<size_t>(k) % _scheduleTable.size()])
+    {
+      if (!_ranThisTick[index])
+      {
+        _ranThisTick[index] = true;
+        _services[index]->runInline();
+      }
+    }
   }
 }
 
@@ -365,6 +983,215 @@ protected:
 private:
 };
 
+//////////////////// SEQUENCER ABSOLUTE DEADLINE ////////////////////
+static long long monotonicNowNs()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now); // vDSO, reads the arch counter without a syscall
+  return static_cast<long long>(now.tv_sec) * 1000000000LL + now.tv_nsec;
+}
+
+static void sleepUntilNs(long long deadlineNs)
+{
+  struct timespec deadline;
+  deadline.tv_sec = deadlineNs / 1000000000LL;
+  deadline.tv_nsec = deadlineNs % 1000000000LL;
+
+  int err;
+  while ((err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)) == EINTR);
+
+  if (err != 0)
+  {
+    std::cerr << "Fatal error - clock_nanosleep failed: " << err << std::endl;
+    exit(FATAL_ERR);
+  }
+}
+
+// Sleeps to absolute CLOCK_MONOTONIC deadlines start + k * period, so dispatch time and wake-up
+// latency of one release never push back the next one. Release error stays bounded instead of drifting.
+class AbsoluteSequencer : public Sequencer
+{
+public:
+  AbsoluteSequencer(uint8_t period, uint8_t priority, uint8_t affinity) : Sequencer(period, priority, affinity)
+  {
+
+  }
+
+  ~AbsoluteSequencer()
+  {
+
+  }
+
+protected:
+  void _waitForRelease() override
+  {
+    if (_releases == 0)
+    {
+      _releases++;
+      return;
+    }
+
+    _skipMissedDeadlines();
+    sleepUntilNs(_nextDeadlineNs());
+    _releases++;
+  }
+
+  void _initializeSequencer() override
+  {
+    _startNs = monotonicNowNs();
+    _releases = 0;
+  }
+
+  // computed from the start every time rather than accumulated, so rounding can't drift either
+  long long _nextDeadlineNs()
+  {
+    return _startNs + _releases * static_cast<long long>(_period) * 1000000LL;
+  }
+
+  /**
+   * Woken more than a period late, every deadline already behind us would otherwise release at once,
+   * back to back. Step past them and account them as skipped, as the timerfd sequencer does.
+   */
+  void _skipMissedDeadlines()
+  {
+    const long long periodNs = static_cast<long long>(_period) * 1000000LL;
+    long long lateNs = monotonicNowNs() - _nextDeadlineNs();
+    if (lateNs >= periodNs)
+    {
+      long long missed = lateNs / periodNs;
+      _releases += missed;
+      _skippedReleases += static_cast<uint64_t>(missed);
+    }
+  }
+
+  long long _startNs = 0;
+  long long _releases = 0;
+};
+
+//////////////////// SEQUENCER HYBRID SLEEP THEN SPIN ////////////////////
+#define HYBRID_INITIAL_GUARD_NS 200000LL
+#define HYBRID_MIN_GUARD_NS 20000LL
+#define HYBRID_GUARD_MARGIN_NS 20000LL
+#define HYBRID_PEAK_DECAY 0.999
+
+// Sleeps to a guard band before each absolute deadline, then spins on the clock until the exact
+// release instant. The sequencer core is dedicated, so its idle time buys release precision.
+// The guard auto-tunes to the wake-up latency tail: a peak hold over observed lateness that
+// decays slowly, plus a margin.
+class HybridSequencer : public AbsoluteSequencer
+{
+public:
+  HybridSequencer(uint8_t period, uint8_t priority, uint8_t affinity) : AbsoluteSequencer(period, priority, affinity)
+  {
+
+  }
+
+  ~HybridSequencer()
+  {
+
+  }
+
+protected:
+  void _waitForRelease() override
+  {
+    if (_releases == 0)
+    {
+      _releases++;
+      return;
+    }
+
+    _skipMissedDeadlines();
+    long long deadlineNs = _nextDeadlineNs();
+    long long wakeNs = deadlineNs - _guardNs;
+
+    if (monotonicNowNs() < wakeNs)
+    {
+      sleepUntilNs(wakeNs);
+      _tuneGuard(monotonicNowNs() - wakeNs);
+    }
+
+    while (monotonicNowNs() < deadlineNs);
+
+    _releases++;
+  }
+
+private:
+  void _tuneGuard(long long latenessNs)
+  {
+    _peakLatenessNs = std::max(static_cast<double>(latenessNs), _peakLatenessNs * HYBRID_PEAK_DECAY);
+
+    long long maxGuardNs = static_cast<long long>(_period) * 1000000LL / 2;
+    _guardNs = std::clamp(static_cast<long long>(_peakLatenessNs) + HYBRID_GUARD_MARGIN_NS, HYBRID_MIN_GUARD_NS, maxGuardNs);
+  }
+
+  long long _guardNs = HYBRID_INITIAL_GUARD_NS;
+  double _peakLatenessNs = HYBRID_INITIAL_GUARD_NS;
+};
+
+//////////////////// SEQUENCER TIMERFD BASED ////////////////////
+// Blocks in read() on a periodic timerfd. Unlike the SIGALRM sequencer nothing runs in signal
+// context, and the expiration count read back tells us exactly how many ticks were missed.
+class TimerFDSequencer : public Sequencer
+{
+public:
+  TimerFDSequencer(uint8_t period, uint8_t priority, uint8_t affinity) : Sequencer(period, priority, affinity)
+  {
+    _fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (_fd == -1)
+    {
+      perror("timerfd_create");
+      exit(-1);
+    }
+  }
+
+  ~TimerFDSequencer()
+  {
+    close(_fd);
+  }
+
+  int releaseFd() override
+  {
+    return _fd;
+  }
+
+protected:
+  void _waitForRelease() override
+  {
+    uint64_t expirations = 0;
+    ssize_t n;
+    while ((n = read(_fd, &expirations, sizeof(expirations))) == -1 && errno == EINTR);
+
+    if (n != sizeof(expirations))
+    {
+      perror("timerfd read");
+      exit(FATAL_ERR);
+    }
+
+    if (expirations > 1)
+    {
+      _skippedReleases += expirations - 1;
+    }
+  }
+
+  void _initializeSequencer() override
+  {
+    struct itimerspec its;
+    its.it_value.tv_sec = 0;
+    its.it_value.tv_nsec = 1; // Start instantly
+    its.it_interval.tv_sec = _period / 1000;
+    its.it_interval.tv_nsec = (_period % 1000) * 1000000L;
+
+    if (timerfd_settime(_fd, 0, &its, NULL) == -1)
+    {
+      perror("timerfd_settime");
+      exit(-1);
+    }
+  }
+
+private:
+  int _fd;
+};
+
 /////////////// SEQUENCER FACTORY ///////////////////
 Sequencer* SequencerFactory::createISRSequencer(uint16_t period, uint8_t priority, uint8_t affinity)
 {
@@ -375,3 +1202,18 @@ Sequencer* SequencerFactory::createSleepSequencer(uint16_t period, uint8_t prior
 {
   return new SleepSequencer(period, priority, affinity);
 }
+
+Sequencer* SequencerFactory::createAbsoluteSequencer(uint16_t period, uint8_t priority, uint8_t affinity)
+{
+  return new AbsoluteSequencer(period, priority, affinity);
+}
+
+Sequencer* SequencerFactory::createTimerFDSequencer(uint16_t period, uint8_t priority, uint8_t affinity)
+{
+  return new TimerFDSequencer(period, priority, affinity);
+}
+
+Sequencer* SequencerFactory::createHybridSequencer(uint16_t period, uint8_t priority, uint8_t affinity)
+{
+  return new HybridSequencer(period, priority, affinity);
+}
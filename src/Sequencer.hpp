@@ -8,6 +8,10 @@
 
 #include "Stats.hpp"
 #include "Logger.hpp"
+#include "Schedulability.hpp"
+#include "MemoryLock.hpp"
+#include "Trace.hpp"
+#include "Telemetry.hpp"
 
 #include <cstdint>
 #include <vector>
@@ -17,6 +21,12 @@
 #include <thread>
 #include <semaphore>
 #include <string>
+#include <unordered_map>
+#include <sys/types.h>
+
+// releases a RELEASE_UPSTREAM service can have queued, one per audio ring slot; other services keep one
+#define SERVICE_MAX_PENDING_RELEASES 4
+#define STATISTICS_FILE "statistics.txt" // appended to by every run
 
 enum ServiceStatus
 {
@@ -25,19 +35,46 @@ enum ServiceStatus
   DEGRADED = 2,
 };
 
+template<>
+struct DenseEnumTraits<ServiceStatus>
+{
+  static constexpr size_t count = DEGRADED + 1;
+};
+
+enum SchedulingPolicy
+{
+  SCHEDULING_FIFO,      // SCHED_FIFO at the service priority
+  SCHEDULING_DEADLINE,  // SCHED_DEADLINE once the sequencer has measured the service's WCET
+};
+
+enum SchedulabilityPolicy
+{
+  SCHEDULABILITY_WARN,    // report services that can miss their deadline but keep them
+  SCHEDULABILITY_REFUSE,  // addService throws if the new service makes any deadline unsafe
+};
+
+enum ReleaseMode
+{
+  RELEASE_CLOCK,  // released by the sequencer every period
+  RELEASE_EVENT,  // releases itself by waiting on an external event, e.g. audio becoming ready
+  RELEASE_UPSTREAM,  // released when every upstream service it depends on has completed successfully
+};
+
 class Service
 {
 public:
-  Service(std::string serviceName, uint16_t period, uint8_t priority, uint8_t affinity, std::shared_ptr<logger::LoggerFactory> loggerFactory) :
+  Service(std::string serviceName, uint16_t period, uint8_t priority, uint8_t affinity, std::shared_ptr<logger::LoggerFactory> loggerFactory, ReleaseMode releaseMode = RELEASE_CLOCK) :
     _serviceName(serviceName),
     _period(period),
     _priority(priority),
     _affinity(affinity),
+    _releaseMode(releaseMode),
     _releaseStats(StatTracker(1000)),
     _executionTimeStats(StatTracker(1000)),
     _releaseService(0)
   {
     _logger = loggerFactory->createLogger(serviceName);
+    _traceSource = tracing::registerSource(serviceName);
     _statusCounter = new StatusCounter<ServiceStatus>();
     _service = std::jthread(&Service::_doService, this);
   }
@@ -51,11 +88,84 @@ public:
   void stop();
   void release();
 
-  uint8_t getPeriod()
+  /**
+   * @brief Run one release of the service on the calling thread, as a cyclic executive does.
+   * The service's own thread stays parked once the service has been marked inline.
+   */
+  void runInline();
+
+  void setInline(bool runsInline)
+  {
+    _inline.store(runsInline);
+  }
+
+  bool runsInline()
+  {
+    return _inline.load();
+  }
+
+  /**
+   * @brief In builds with RT_ALLOCATION_GUARD, abort if the service allocates after its first run,
+   * whether it runs on its own thread or inline on the sequencer's.
+   */
+  void guardAllocations(bool guard)
+  {
+    _guardAllocations = guard;
+  }
+
+  uint16_t getPeriod()
   {
     return _period;
   }
 
+  uint8_t getPriority()
+  {
+    return _priority;
+  }
+
+  uint8_t getAffinity()
+  {
+    return _affinity;
+  }
+
+  /**
+   * @brief Declared worst-case execution time used by the admission analysis before anything has
+   * been measured, e.g. the max from a previous run's STATISTICS_FILE. Zero means unknown.
+   */
+  void setWcetEstimate(double wcetMs)
+  {
+    _wcetEstimateMs = wcetMs;
+  }
+
+  double wcetEstimate()
+  {
+    return _wcetEstimateMs;
+  }
+
+  ReleaseMode releaseMode()
+  {
+    return _releaseMode;
+  }
+
+  SchedulingPolicy schedulingPolicy()
+  {
+    return _schedulingPolicy;
+  }
+
+  /**
+   * @brief Ask the sequencer to move this service to SCHED_DEADLINE after calibration. Call before addService.
+   */
+  void setSchedulingPolicy(SchedulingPolicy policy)
+  {
+    _schedulingPolicy = policy;
+  }
+
+  /**
+   * @brief Switch the running service thread to SCHED_DEADLINE. Subject to the kernel's CBS admission control.
+   * @return 0 on success, otherwise the errno from sched_setattr (EBUSY when admission is refused).
+   */
+  int applyDeadlineScheduling(uint64_t runtimeNs, uint64_t deadlineNs, uint64_t periodNs);
+
   StatTracker releaseStats()
   {
     return _releaseStats;
@@ -66,6 +176,23 @@ public:
     return _executionTimeStats;
   }
 
+  /**
+   * @brief Page faults taken before the service's first run completed, on its own thread plus those
+   * charged to it while running inline. Valid after stop().
+   */
+  rt::PageFaults startupPageFaults()
+  {
+    return {_startupFaults.minor + _inlineStartupFaults.minor, _startupFaults.major + _inlineStartupFaults.major};
+  }
+
+  /**
+   * @brief Page faults taken by the service's runs after the first, on its own thread or inline. Valid after stop().
+   */
+  rt::PageFaults runningPageFaults()
+  {
+    return {_runningFaults.minor + _inlineRunningFaults.minor, _runningFaults.major + _inlineRunningFaults.major};
+  }
+
   std::string serviceName()
   {
     return _serviceName;
@@ -79,14 +206,33 @@ public:
 protected:
   virtual ServiceStatus _serviceFunction() = 0;
 
+  /**
+   * @brief Block until the event that releases a RELEASE_EVENT service occurs.
+   * @return false if nothing happened within timeoutMs.
+   */
+  virtual bool _waitForEvent(int timeoutMs)
+  {
+    (void)timeoutMs;
+    return false;
+  }
+
   std::string _serviceName;
   uint16_t _period;
   uint8_t _priority;
   uint8_t _affinity;
+  ReleaseMode _releaseMode;
+  SchedulingPolicy _schedulingPolicy = SCHEDULING_FIFO;
+  double _wcetEstimateMs = 0.0;
+  uint32_t _traceSource;
+  bool _guardAllocations = false;
 
 private:
   void _initializeService();
   void _doService();
+  void _recordRelease();
+  void _execute();
+  void _releaseDownstream();
+  void _upstreamCompleted();
 
   // Constructor parameters - order matters
   std::function<void(void)> _function;
@@ -94,10 +240,24 @@ private:
   StatTracker _releaseStats;
   StatTracker _executionTimeStats;
   long _releaseNumber = 0;
-  std::counting_semaphore<1> _releaseService;
+  std::counting_semaphore<SERVICE_MAX_PENDING_RELEASES> _releaseService;
+  std::atomic<int> _pendingReleases = std::atomic<int>(0);
   logger::Logger *_logger;
   StatusCounter<ServiceStatus> *_statusCounter;
 
+  std::atomic<pid_t> _tid = std::atomic<pid_t>(0);
+  std::atomic<bool> _inline = std::atomic<bool>(false);
+  bool _inlineWarmedUp = false; // inline state is touched only by the thread running it inline
+  rt::PageFaults _inlineStartupFaults;
+  rt::PageFaults _inlineRunningFaults;
+  rt::PageFaults _startupFaults;
+  rt::PageFaults _runningFaults;
+
+  // pipeline edges, fixed before the sequencer starts
+  friend class Sequencer;
+  std::vector<Service*> _downstream;
+  int _upstreamCount = 0;
+  std::atomic<int> _upstreamPending = std::atomic<int>(0);
   volatile std::atomic<bool> _serviceStarted = std::atomic<bool>(false);
   volatile std::atomic<bool> _running = std::atomic<bool>(true);
   volatile std::atomic<std::chrono::high_resolution_clock::time_point> _firstRelease;
@@ -114,23 +274,130 @@ public:
   void addService(std::unique_ptr<Service> service)
   {
     _services.emplace_back(std::move(service));
+    _applyWcetEstimate(*_services.back());
+
+    // event and upstream released services don't run on the sequencer's period grid
+    if (_services[_services.size() - 1]->releaseMode() == RELEASE_CLOCK)
+    {
+      _checkPeriodCompatability(_services[_services.size() - 1]->getPeriod());
+    }
+
+    _admitService();
+
+    if (_cyclicExecutive)
+    {
+      _buildScheduleTable();
+    }
+  }
+
+  /**
+   * @brief Run clock released services inline on the sequencer thread from a schedule table
+   * covering one hyperperiod, instead of waking each service's thread. Within a minor frame services
+   * run in priority order. Event released services keep their own threads.
+   */
+  void useCyclicExecutive(bool enabled)
+  {
+    _cyclicExecutive = enabled;
+    _buildScheduleTable();
+  }
+
+  /**
+   * @brief Release downstream every time upstream completes successfully, instead of on the clock.
+   * Both services must already be added and downstream must be RELEASE_UPSTREAM. A service with
+   * several upstreams is released once all of them have completed. Call before startServices.
+   */
+  void addDependency(Service *upstream, Service *downstream);
 
-    _checkPeriodCompatability(_services[_services.size() - 1]->getPeriod());
+  /**
+   * @brief What addService does when the declared WCETs make the service set unschedulable.
+   */
+  void setSchedulabilityPolicy(SchedulabilityPolicy policy)
+  {
+    _schedulabilityPolicy = policy;
   }
 
+  /**
+   * @brief Declare the WCET of every service added from now on that has none of its own as its whole
+   * run execution time max from the most recent run recorded in a statistics file.
+   * @return the number of services the file has a WCET for; 0 if it could not be read.
+   */
+  size_t loadWcetEstimates(const std::string &statisticsFile);
+
+  /**
+   * @brief Response-time analysis of the current service set.
+   * @param measured use the larger of each service's declared and measured WCET instead of only the declared one.
+   */
+  SchedulabilityReport checkSchedulability(bool measured);
+
+  /**
+   * @brief Copy the live statistics of the sequencer and its services into a telemetry segment.
+   * Reads only what the real-time threads already publish, so it is safe from any one non real-time
+   * thread. Also runs the periodic measured schedulability check the sequencer thread asks for.
+   */
+  void fillTelemetry(TelemetrySegment &segment);
+
   void startServices(std::shared_ptr<std::atomic<bool>> keepRunning);
   void stopServices(bool statisticsToFile);
 
+  /**
+   * @brief File descriptor that becomes readable on every release, for use with epoll.
+   * @return -1 if the sequencer is not fd based.
+   */
+  virtual int releaseFd()
+  {
+    return -1;
+  }
+
+  /**
+   * @brief Move services that asked for SCHED_DEADLINE onto it after calibrationIterations sequencer
+   * periods under SCHED_FIFO. Runtime is the measured WCET times wcetMargin; deadline and period are
+   * the service period. If the kernel refuses admission the sequencer stops. startServices refuses to
+   * start at all when SCHED_DEADLINE admission control is disabled (sched_rt_runtime_us = -1) or the
+   * kernel will not admit a deadline task on a service's core.
+   */
+  void useDeadlineScheduling(long calibrationIterations, double wcetMargin)
+  {
+    _deadlineCalibrationIterations = calibrationIterations;
+    _wcetMargin = wcetMargin;
+  }
+
 protected:
   std::vector<std::unique_ptr<Service>> _services;
   uint16_t _period;
   StatTracker _stats;
 
+  // set by _waitForRelease when it knows ticks went by unserviced
+  uint64_t _skippedReleases = 0;
+  std::atomic<uint64_t> _missedReleases = 0;
+  rt::PageFaults _startupFaults;
+  uint32_t _traceSource;
+
+  SchedulabilityPolicy _schedulabilityPolicy = SCHEDULABILITY_WARN;
+  std::unordered_map<std::string, double> _wcetEstimates; // by service name
+  bool _measuredSchedulable = true; // telemetry publisher only
+  std::atomic<bool> _schedulabilityCheckDue = false;
+
+  // cyclic executive: one entry per minor frame of the hyperperiod, holding indices into _services
+  bool _cyclicExecutive = false;
+  std::vector<std::vector<size_t>> _scheduleTable;
+  std::vector<bool> _ranThisTick;
+
+  long _deadlineCalibrationIterations = 0;
+  double _wcetMargin = 1.5;
+
   virtual void _waitForRelease() = 0;
   virtual void _initializeSequencer() = 0;
 
 private:
   void _checkPeriodCompatability(uint16_t servicePeriod);
+  bool _checkDeadlineSupport();
+  bool _admitDeadlineServices();
+  void _applyWcetEstimate(Service &service);
+  void _admitService();
+  void _checkMeasuredSchedulability();
+  void _buildScheduleTable();
+  void _runScheduleTable(long first, long last);
+  static bool _reaches(Service *from, Service *to);
 };
 
 
@@ -142,4 +409,7 @@ public:
 
   Sequencer* createISRSequencer(uint16_t period, uint8_t priority, uint8_t affinity);
   Sequencer* createSleepSequencer(uint16_t period, uint8_t priority, uint8_t affinity);
+  Sequencer* createAbsoluteSequencer(uint16_t period, uint8_t priority, uint8_t affinity);
+  Sequencer* createTimerFDSequencer(uint16_t period, uint8_t priority, uint8_t affinity);
+  Sequencer* createHybridSequencer(uint16_t period, uint8_t priority, uint8_t affinity);
 };
\ No newline at end of file
@@ -0,0 +1,104 @@
+/**
+ * @file SpectrumSnapshot.hpp
+ * @brief Latest spectrum published by the FFT service for the output services.
+ *
+ * Single writer seqlock. The FFT service never waits on a reader; a reader that races a publish
+ * copies again, a bounded number of times. The sequence counter doubles as a generation number so readers can tell a
+ * new frame from one they have already shown.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+#define SPECTRUM_MAX_BUCKETS 16
+#define SPECTRUM_READ_ATTEMPTS 2 // torn copies a reader tolerates before keeping its previous frame
+
+struct SpectrumFrame
+{
+  uint64_t generation = 0;  // 0 until the first publish
+  uint64_t timestampNs = 0; // CLOCK_MONOTONIC at publish
+  size_t buckets = 0;
+  uint32_t magnitudes[SPECTRUM_MAX_BUCKETS] = {0};
+};
+
+class SpectrumSnapshot
+{
+public:
+  SpectrumSnapshot() = default;
+
+  /**
+   * @brief Writer side. Only one thread may publish.
+   */
+  void publish(const uint32_t *magnitudes, size_t buckets, uint64_t timestampNs)
+  {
+    buckets = std::min(buckets, static_cast<size_t>(SPECTRUM_MAX_BUCKETS));
+
+    uint64_t sequence = _sequence.load(std::memory_order_relaxed);
+    _sequence.store(sequence + 1, std::memory_order_relaxed); // odd while the frame is being written
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (size_t i = 0; i < buckets; i++)
+    {
+      _magnitudes[i].store(magnitudes[i], std::memory_order_relaxed);
+    }
+    _buckets.store(buckets, std::memory_order_relaxed);
+    _timestampNs.store(timestampNs, std::memory_order_relaxed);
+
+    _sequence.store(sequence + 2, std::memory_order_release);
+  }
+
+  /**
+   * @brief Reader side. Copy the latest frame. Never blocks the writer.
+   *
+   * The reader may share a core with the writer at a higher priority, in which case a publish it
+   * interrupted cannot finish until the reader yields. It therefore gives up after
+   * SPECTRUM_READ_ATTEMPTS torn copies and leaves frame untouched, so the caller keeps showing the
+   * previous frame and picks up the new one on its next release.
+   * @return true if frame was updated with a frame newer than lastGeneration.
+   */
+  bool read(SpectrumFrame &frame, uint64_t lastGeneration) const
+  {
+    SpectrumFrame copy;
+    for (int attempt = 0; attempt < SPECTRUM_READ_ATTEMPTS; attempt++)
+    {
+      uint64_t before = _sequence.load(std::memory_order_acquire);
+      if (before & 1)
+      {
+        continue;
+      }
+
+      copy.buckets = _buckets.load(std::memory_order_relaxed);
+      copy.timestampNs = _timestampNs.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < copy.buckets; i++)
+      {
+        copy.magnitudes[i] = _magnitudes[i].load(std::memory_order_relaxed);
+      }
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (_sequence.load(std::memory_order_relaxed) != before)
+      {
+        continue;
+      }
+
+      copy.generation = before / 2;
+      if (copy.generation <= lastGeneration)
+      {
+        return false;
+      }
+
+      frame = copy;
+      return true;
+    }
+
+    return false;
+  }
+
+private:
+  std::atomic<uint64_t> _sequence{0};
+  std::atomic<uint64_t> _timestampNs{0};
+  std::atomic<size_t> _buckets{0};
+  std::atomic<uint32_t> _magnitudes[SPECTRUM_MAX_BUCKETS] = {};
+};
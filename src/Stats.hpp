@@ -1,7 +1,8 @@
 /**
  * @file Stats.hpp 
  * File to calculate statistics for different processes. 
- * Uses a circular buffer of a given size to prevent dynamic allocations to the buffer.
+ * Uses a circular buffer of a given size to prevent dynamic allocations to the buffer, plus
+ * log-bucketed histograms for percentiles over that window and over the whole run.
  */
 #pragma once
 
@@ -13,6 +14,9 @@
 #include <unordered_map>
 #include <type_traits>
 #include <memory>
+#include <atomic>
+#include <array>
+#include <cstdint>
 
 struct StatPoint
 {
@@ -21,127 +25,474 @@ struct StatPoint
 
 inline bool compareAscending(StatPoint a, StatPoint b)
 {
-  return a.timeMs > b.timeMs;
+  return a.timeMs < b.timeMs;
 }
 
-template<typename T> requires std::is_enum_v<T>
+/**
+ * Opt-in trait for enums whose values are exactly 0..count-1. Specialize it next to the enum to get
+ * the array-backed StatusCounter below.
+ */
+template<typename T>
+struct DenseEnumTraits
+{
+  static constexpr size_t count = 0;
+};
+
+template<typename T>
+concept StatusEnum = std::is_enum_v<T>;
+
+template<typename T>
+concept DenseStatusEnum = StatusEnum<T> && (DenseEnumTraits<T>::count > 0);
+
+template<StatusEnum T>
 class StatusCounter
 {
 private:
-  std::unordered_map<T, int> _counts;
+  std::unordered_map<T, uint64_t> _counts;
 public:
   StatusCounter() = default;
 
+  /**
+   * @brief Create the counter for t up front so Add never allocates.
+   */
+  void Track(T t)
+  {
+    _counts.try_emplace(t, 0);
+  }
+
   void Add(T t)
   {
     _counts[t]++;
   }
 
-  int GetCount(T t)
+  uint64_t GetCount(T t) const
   {
-    return _counts[t];
+    auto count = _counts.find(t);
+    return count == _counts.end() ? 0 : count->second;
   }
 };
 
-class StatTracker
+#define STATUS_WINDOW 1000 // executions covered by the windowed rates, same as the StatTracker windows
+
+/**
+ * Counter for dense enums: one atomic per value plus the statuses of the last STATUS_WINDOW adds.
+ * Single writer, no hashing or allocation; any thread may query while it is being written, at the
+ * cost of a snapshot that can be off by the adds made meanwhile.
+ */
+template<DenseStatusEnum T>
+class StatusCounter<T>
 {
+private:
+  static constexpr size_t N = DenseEnumTraits<T>::count;
+
+  std::array<std::atomic<uint64_t>, N> _counts{};
+  std::array<std::atomic<uint64_t>, N> _windowCounts{};
+  std::array<std::atomic<uint8_t>, STATUS_WINDOW> _window{};
+  std::atomic<uint64_t> _total{0};
+
+  static void _increment(std::atomic<uint64_t> &counter, int64_t delta)
+  {
+    // single writer, so no locked read-modify-write is needed
+    counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+  }
+
 public:
-  StatTracker(unsigned int bufferSize)
+  static_assert(N <= std::numeric_limits<uint8_t>::max(), "window entries are stored as uint8_t");
+
+  StatusCounter() = default;
+
+  /**
+   * @brief Every value already has a counter; kept so callers can treat both counters alike.
+   */
+  void Track(T) {}
+
+  void Add(T t)
   {
-    _bufferSize = bufferSize;
-    _arr = std::make_shared<StatPoint[]>(bufferSize);
-    _totalElements = 0;
-    _sum = 0;
+    size_t index = static_cast<size_t>(t);
+    if (index >= N)
+    {
+      return;
+    }
+
+    uint64_t total = _total.load(std::memory_order_relaxed);
+    auto &slot = _window[total % STATUS_WINDOW];
+    if (total >= STATUS_WINDOW)
+    {
+      _increment(_windowCounts[slot.load(std::memory_order_relaxed)], -1);
+    }
+    slot.store(static_cast<uint8_t>(index), std::memory_order_relaxed);
+    _increment(_windowCounts[index], 1);
+    _increment(_counts[index], 1);
+    _total.store(total + 1, std::memory_order_release);
   }
 
-  // copies the struct. Might not be high perf.
-  void Add(StatPoint stat)
+  uint64_t GetCount(T t) const
   {
-    auto tmp = _arr[index];
+    size_t index = static_cast<size_t>(t);
+    return index < N ? _counts[index].load(std::memory_order_relaxed) : 0;
+  }
+
+  uint64_t GetTotal() const
+  {
+    return _total.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief Times t was added among the last STATUS_WINDOW adds.
+   */
+  uint64_t GetWindowCount(T t) const
+  {
+    size_t index = static_cast<size_t>(t);
+    return index < N ? _windowCounts[index].load(std::memory_order_relaxed) : 0;
+  }
+
+  /**
+   * @brief Fraction (0..1) of the last STATUS_WINDOW adds that were t, 0 before the first add.
+   */
+  double GetWindowRate(T t) const
+  {
+    uint64_t total = std::min(GetTotal(), static_cast<uint64_t>(STATUS_WINDOW));
+    return total == 0 ? 0.0 : std::min(1.0, static_cast<double>(GetWindowCount(t)) / static_cast<double>(total));
+  }
+};
 
-    _arr[index] = stat;
-    index = (index + 1) % _bufferSize;
+// HDR style log-bucketed histogram over microseconds: values below 2^HISTOGRAM_SUB_BITS us are
+// exact, larger ones land in one of 2^(HISTOGRAM_SUB_BITS-1) sub-buckets per power of two (~1.6% error)
+#define HISTOGRAM_SUB_BITS 7
+#define HISTOGRAM_MAX_MSB 30 // 2^31us, about 35 minutes; anything larger counts in the top bucket
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_HALF_COUNT (HISTOGRAM_SUB_COUNT / 2)
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_COUNT + (HISTOGRAM_MAX_MSB - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_HALF_COUNT)
 
-    _sum += stat.timeMs;
-    
-    if (_totalElements < _bufferSize)
+/**
+ * Fixed memory histogram of signed millisecond values. Single writer; any thread may query while it
+ * is being written, at the cost of a snapshot that can be off by the samples added meanwhile.
+ */
+class LogHistogram
+{
+public:
+  void Record(double valueMs, int delta = 1)
+  {
+    auto &counts = valueMs < 0.0 ? _negative : _positive;
+    size_t index = BucketIndex(valueMs);
+    // single writer, so no locked read-modify-write is needed
+    counts[index].store(counts[index].load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    _count.store(_count.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+  }
+
+  uint64_t Count() const
+  {
+    return _count.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Value at fraction (0..1] of the recorded samples, as the midpoint of its bucket.
+   */
+  double Percentile(double fraction) const
+  {
+    uint64_t count = Count();
+    if (count == 0)
     {
-      _totalElements++;
+      return 0.0;
     }
-    else
+
+    uint64_t rank = static_cast<uint64_t>(std::ceil(std::clamp(fraction, 0.0, 1.0) * static_cast<double>(count)));
+    rank = std::max<uint64_t>(rank, 1);
+
+    uint64_t seen = 0;
+    for (size_t i = HISTOGRAM_BUCKETS; i-- > 0;)
+    {
+      seen += _negative[i].load(std::memory_order_relaxed);
+      if (seen >= rank)
+      {
+        return -BucketMidpointMs(i);
+      }
+    }
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
     {
-      _sum -= tmp.timeMs;
+      seen += _positive[i].load(std::memory_order_relaxed);
+      if (seen >= rank)
+      {
+        return BucketMidpointMs(i);
+      }
     }
+
+    // samples were added while scanning
+    return Max();
   }
 
-  double GetAverageDurationMs()
+  /**
+   * @brief Upper bound of the highest non-empty bucket, so it never under-reports a worst case.
+   */
+  double Max() const
   {
-    return _sum / static_cast<double>(_totalElements);
+    for (size_t i = HISTOGRAM_BUCKETS; i-- > 0;)
+    {
+      if (_positive[i].load(std::memory_order_relaxed) > 0)
+      {
+        return BucketUpperMs(i);
+      }
+    }
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+      if (_negative[i].load(std::memory_order_relaxed) > 0)
+      {
+        return -BucketLowerMs(i);
+      }
+    }
+    return 0.0;
   }
 
-  double GetMaxVal()
+  /**
+   * @brief Lower bound of the lowest non-empty bucket.
+   */
+  double Min() const
   {
-    double maxVal = 0.0;
-    for (int i = 0; i < _totalElements; i++)
+    for (size_t i = HISTOGRAM_BUCKETS; i-- > 0;)
     {
-      if (_arr[i].timeMs > maxVal)
+      if (_negative[i].load(std::memory_order_relaxed) > 0)
       {
-        maxVal = _arr[i].timeMs;  
+        return -BucketUpperMs(i);
       }
     }
-    return maxVal;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+      if (_positive[i].load(std::memory_order_relaxed) > 0)
+      {
+        return BucketLowerMs(i);
+      }
+    }
+    return 0.0;
   }
 
-  double GetMinVal()
+  /**
+   * @brief Number of samples whose bucket lies entirely at or below limitMs.
+   */
+  uint64_t CountAtOrBelow(double limitMs) const
   {
-    double minVal = std::numeric_limits<double>::max();
-    for (int i = 0; i < _totalElements; i++)
+    uint64_t total = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
     {
-      if (_arr[i].timeMs < minVal)
+      // every negative bucket is below a non-negative limit
+      if (limitMs >= 0.0 || -BucketLowerMs(i) <= limitMs)
+      {
+        total += _negative[i].load(std::memory_order_relaxed);
+      }
+      if (BucketUpperMs(i) <= limitMs)
       {
-        minVal = _arr[i].timeMs;  
+        total += _positive[i].load(std::memory_order_relaxed);
       }
     }
-    return minVal;
+    return total;
   }
 
-  double GetPercentile(double percentile)
+  static size_t BucketIndex(double valueMs)
   {
-    StatPoint *sorted = new StatPoint[_bufferSize];
-    
-    std::copy(_arr.get(), _arr.get() + _bufferSize, sorted);
-    std::sort(sorted, sorted + _bufferSize, compareAscending);
+    double magnitudeUs = std::min(std::fabs(valueMs) * 1000.0 + 0.5, static_cast<double>(UINT64_MAX >> 1));
+    uint64_t v = static_cast<uint64_t>(magnitudeUs);
+    if (v < HISTOGRAM_SUB_COUNT)
+    {
+      return static_cast<size_t>(v);
+    }
 
-    auto el = static_cast<int>(std::floor(static_cast<double>(_bufferSize) * percentile));
-    double result = sorted[el].timeMs;
+    int msb = std::min(63 - __builtin_clzll(v), HISTOGRAM_MAX_MSB);
+    int shift = msb - (HISTOGRAM_SUB_BITS - 1);
+    uint64_t sub = std::min<uint64_t>(v >> shift, HISTOGRAM_SUB_COUNT - 1);
+    return HISTOGRAM_SUB_COUNT + static_cast<size_t>(shift - 1) * HISTOGRAM_HALF_COUNT + static_cast<size_t>(sub - HISTOGRAM_HALF_COUNT);
+  }
 
-    delete[] sorted;
-    return result;
+  static double BucketLowerMs(size_t index)
+  {
+    if (index < HISTOGRAM_SUB_COUNT)
+    {
+      return static_cast<double>(index) / 1000.0;
+    }
+    size_t k = index - HISTOGRAM_SUB_COUNT;
+    uint64_t shift = k / HISTOGRAM_HALF_COUNT + 1;
+    uint64_t sub = k % HISTOGRAM_HALF_COUNT + HISTOGRAM_HALF_COUNT;
+    return static_cast<double>(sub << shift) / 1000.0;
   }
 
-  int GetNumberCompletedOnTime(double deadline)
+  static double BucketUpperMs(size_t index)
   {
-    long count = 0;
-    for (int i = 0; i < _totalElements; i++)
+    if (index < HISTOGRAM_SUB_COUNT)
     {
-      if (_arr[i].timeMs <= deadline)
-      {
-        count++;
-      }
+      return static_cast<double>(index) / 1000.0;
+    }
+    size_t k = index - HISTOGRAM_SUB_COUNT;
+    uint64_t shift = k / HISTOGRAM_HALF_COUNT + 1;
+    uint64_t sub = k % HISTOGRAM_HALF_COUNT + HISTOGRAM_HALF_COUNT;
+    return static_cast<double>(((sub + 1) << shift) - 1) / 1000.0;
+  }
+
+  static double BucketMidpointMs(size_t index)
+  {
+    return (BucketLowerMs(index) + BucketUpperMs(index)) / 2.0;
+  }
+
+private:
+  std::atomic<uint32_t> _positive[HISTOGRAM_BUCKETS] = {};
+  std::atomic<uint32_t> _negative[HISTOGRAM_BUCKETS] = {};
+  std::atomic<uint64_t> _count{0};
+};
+
+/**
+ * Statistics over the last bufferSize samples (the window) and over the whole run. Insert is O(1)
+ * and queries are O(buckets) with no allocation, so they can run live from any thread. Copies share
+ * the same underlying data.
+ */
+class StatTracker
+{
+public:
+  StatTracker(unsigned int bufferSize)
+  {
+    _state = std::make_shared<State>();
+    _state->bufferSize = bufferSize;
+    _state->arr = std::make_unique<std::atomic<double>[]>(bufferSize);
+  }
+
+  void Add(StatPoint stat)
+  {
+    State &s = *_state;
+    int index = s.index.load(std::memory_order_relaxed);
+    int total = s.totalElements.load(std::memory_order_relaxed);
+    double sum = s.sum.load(std::memory_order_relaxed);
+
+    if (total == s.bufferSize)
+    {
+      // the window is full, evict the sample being overwritten
+      double evicted = s.arr[index].load(std::memory_order_relaxed);
+      s.window.Record(evicted, -1);
+      sum -= evicted;
     }
-    return count;         
+    else
+    {
+      s.totalElements.store(total + 1, std::memory_order_relaxed);
+    }
+
+    s.arr[index].store(stat.timeMs, std::memory_order_relaxed);
+    s.index.store((index + 1) % s.bufferSize, std::memory_order_release);
+    s.sum.store(sum + stat.timeMs, std::memory_order_relaxed);
+    s.window.Record(stat.timeMs);
+
+    s.run.Record(stat.timeMs);
+    s.runSum.store(s.runSum.load(std::memory_order_relaxed) + stat.timeMs, std::memory_order_relaxed);
+    if (stat.timeMs > s.runMax.load(std::memory_order_relaxed))
+    {
+      s.runMax.store(stat.timeMs, std::memory_order_relaxed);
+    }
+    if (stat.timeMs < s.runMin.load(std::memory_order_relaxed))
+    {
+      s.runMin.store(stat.timeMs, std::memory_order_relaxed);
+    }
+  }
+
+  double GetAverageDurationMs()
+  {
+    return _state->sum.load(std::memory_order_relaxed) / static_cast<double>(GetNumElements());
+  }
+
+  /**
+   * @brief Window maximum, rounded up to its histogram bucket.
+   */
+  double GetMaxVal()
+  {
+    return _state->window.Max();
+  }
+
+  /**
+   * @brief Window minimum, rounded down to its histogram bucket.
+   */
+  double GetMinVal()
+  {
+    return _state->window.Min();
+  }
+
+  /**
+   * @brief Window percentile, percentile in 0..1.
+   */
+  double GetPercentile(double percentile)
+  {
+    return _state->window.Percentile(percentile);
+  }
+
+  int GetNumberCompletedOnTime(double deadline)
+  {
+    return static_cast<int>(_state->window.CountAtOrBelow(deadline));
   }
 
   int GetNumElements()
   {
-    return _totalElements;
+    return _state->totalElements.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Exact maximum over every sample since construction.
+   */
+  double GetRunMaxVal()
+  {
+    return GetRunCount() == 0 ? 0.0 : _state->runMax.load(std::memory_order_relaxed);
+  }
+
+  double GetRunMinVal()
+  {
+    return GetRunCount() == 0 ? 0.0 : _state->runMin.load(std::memory_order_relaxed);
+  }
+
+  double GetRunAverageMs()
+  {
+    uint64_t count = GetRunCount();
+    return count == 0 ? 0.0 : _state->runSum.load(std::memory_order_relaxed) / static_cast<double>(count);
+  }
+
+  double GetRunPercentile(double percentile)
+  {
+    return _state->run.Percentile(percentile);
+  }
+
+  uint64_t GetRunCount()
+  {
+    return _state->run.Count();
+  }
+
+  uint64_t GetRunCountAtOrBelow(double limitMs)
+  {
+    return _state->run.CountAtOrBelow(limitMs);
+  }
+
+  /**
+   * @brief Copy up to n of the most recent samples, newest first.
+   * @return number of samples copied.
+   */
+  size_t GetRecent(double *out, size_t n)
+  {
+    State &s = *_state;
+    size_t available = std::min(n, static_cast<size_t>(GetNumElements()));
+    int index = s.index.load(std::memory_order_acquire);
+
+    for (size_t i = 0; i < available; i++)
+    {
+      index = (index + s.bufferSize - 1) % s.bufferSize;
+      out[i] = s.arr[index].load(std::memory_order_relaxed);
+    }
+    return available;
   }
 
 private:
-  std::shared_ptr<StatPoint[]> _arr;
-  double _averageDuration = 0.0;
-  int index = 0;
-  double _sum;
-  int _bufferSize;
-  int _totalElements;
+  struct State
+  {
+    std::unique_ptr<std::atomic<double>[]> arr;
+    int bufferSize = 0;
+    std::atomic<int> index{0};
+    std::atomic<int> totalElements{0};
+    std::atomic<double> sum{0.0};
+
+    LogHistogram window;
+    LogHistogram run;
+    std::atomic<double> runSum{0.0};
+    std::atomic<double> runMax{std::numeric_limits<double>::lowest()};
+    std::atomic<double> runMin{std::numeric_limits<double>::max()};
+  };
+
+  std::shared_ptr<State> _state;
 };
@@ -0,0 +1,110 @@
+/**
+ * @file Telemetry.cpp
+ */
+
+#include "Telemetry.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <new>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+TelemetryPublisher::TelemetryPublisher(std::function<void(TelemetrySegment &)> fill) : _fill(fill)
+{
+}
+
+TelemetryPublisher::~TelemetryPublisher()
+{
+  stop();
+}
+
+bool TelemetryPublisher::start()
+{
+  int fd = shm_open(TELEMETRY_SHM_NAME, O_CREAT | O_RDWR, 0644);
+  if (fd < 0)
+  {
+    return false;
+  }
+
+  if (ftruncate(fd, sizeof(TelemetrySegment)) != 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  void *mapping = mmap(nullptr, sizeof(TelemetrySegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+  {
+    return false;
+  }
+
+  // header last, so a reader never sees a valid magic over a half initialized segment
+  std::memset(mapping, 0, sizeof(TelemetrySegment));
+  _segment = new (mapping) TelemetrySegment();
+  _segment->size = sizeof(TelemetrySegment);
+  _segment->writerPid = getpid();
+  _segment->version = TELEMETRY_VERSION;
+  std::atomic_thread_fence(std::memory_order_release);
+  _segment->magic = TELEMETRY_MAGIC;
+
+  _thread = std::jthread([this](std::stop_token stop) { _run(stop); });
+  return true;
+}
+
+void TelemetryPublisher::stop()
+{
+  if (_segment == nullptr)
+  {
+    return;
+  }
+
+  _thread.request_stop();
+  if (_thread.joinable())
+  {
+    _thread.join();
+  }
+
+  // publish the final numbers, then leave the segment for readers until the next run replaces it
+  _publish();
+  munmap(_segment, sizeof(TelemetrySegment));
+  _segment = nullptr;
+}
+
+void TelemetryPublisher::_run(std::stop_token stop)
+{
+  // stay off the real-time cores and out of the SCHED_FIFO band
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  CPU_SET(TELEMETRY_PUBLISHER_CORE, &cpuset);
+  pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+
+  sched_param sch;
+  sch.sched_priority = 0;
+  pthread_setschedparam(pthread_self(), SCHED_OTHER, &sch);
+
+  while (!stop.stop_requested())
+  {
+    _publish();
+    std::this_thread::sleep_for(std::chrono::milliseconds(TELEMETRY_PUBLISH_PERIOD_MS));
+  }
+}
+
+void TelemetryPublisher::_publish()
+{
+  uint64_t sequence = _segment->sequence.load(std::memory_order_relaxed);
+  _segment->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  _segment->publishedNs = static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + static_cast<uint64_t>(now.tv_nsec);
+  _fill(*_segment);
+
+  _segment->sequence.store(sequence + 2, std::memory_order_release);
+}
@@ -0,0 +1,161 @@
+/**
+ * @file Telemetry.hpp
+ * @brief Live statistics in a POSIX shared-memory segment, read by the rtstat monitor.
+ *
+ * The layout below is the contract between the sequencer and rtstat; bump TELEMETRY_VERSION on any
+ * change to it. A low priority publisher thread refreshes the whole segment from the services'
+ * statistics under a seqlock, so the real-time threads never make a syscall or take a lock for it.
+ * Readers copy the segment and retry, a bounded number of times, if the sequence changed or was odd
+ * while they copied.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+#define TELEMETRY_SHM_NAME "/rt_audio_telemetry"
+#define TELEMETRY_MAGIC 0x54535452 // "RTST"
+#define TELEMETRY_VERSION 2
+#define TELEMETRY_MAX_SERVICES 8
+#define TELEMETRY_NAME_LENGTH 32
+#define TELEMETRY_LAST_N 16
+#define TELEMETRY_HISTOGRAM_BINS 20 // execution time histogram, bin i counts runs up to 2^i us not in an earlier bin; the last takes the rest
+#define TELEMETRY_STATUS_COUNT 3    // SUCCESS, FAILURE, DEGRADED
+#define TELEMETRY_PUBLISH_PERIOD_MS 100
+#define TELEMETRY_PUBLISHER_CORE 0
+#define TELEMETRY_READ_ATTEMPTS 64 // torn copies readTelemetry tolerates before it gives up
+
+struct TelemetryTimings
+{
+  double averageMs;
+  double maxMs;
+  double p50Ms;
+  double p99Ms;
+  double p999Ms;
+};
+
+struct TelemetryService
+{
+  char name[TELEMETRY_NAME_LENGTH];
+  uint16_t periodMs;
+  uint8_t priority;
+  uint8_t affinity;
+  uint8_t releaseMode;
+  uint64_t executions;
+  uint64_t status[TELEMETRY_STATUS_COUNT];
+  uint32_t statusWindow;                     // executions the rates cover, at most STATUS_WINDOW
+  double statusRate[TELEMETRY_STATUS_COUNT]; // fraction of those executions per status
+  TelemetryTimings execution;  // whole run
+  TelemetryTimings releaseError; // whole run, release time minus ideal release time
+  uint32_t recentCount;
+  double recentExecutionMs[TELEMETRY_LAST_N]; // newest first
+  uint64_t executionHistogram[TELEMETRY_HISTOGRAM_BINS];
+};
+
+struct TelemetrySequencer
+{
+  uint16_t periodMs;
+  uint64_t ticks;
+  uint64_t missedReleases;
+  TelemetryTimings releaseError;
+};
+
+struct TelemetrySegment
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;  // sizeof(TelemetrySegment) as built by the writer
+  int32_t writerPid;
+  std::atomic<uint64_t> sequence; // odd while the publisher is writing
+  uint64_t publishedNs;           // CLOCK_MONOTONIC
+  TelemetrySequencer sequencer;
+  uint32_t serviceCount;
+  TelemetryService services[TELEMETRY_MAX_SERVICES];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the telemetry seqlock must work across processes");
+
+enum TelemetryRead
+{
+  TELEMETRY_READ_OK,
+  TELEMETRY_READ_INCOMPATIBLE, // not a telemetry segment of this version
+  TELEMETRY_READ_TORN,         // a publish was in progress for every attempt; copy is unspecified
+};
+
+/**
+ * @brief Consistent copy of a segment another thread or process is publishing.
+ *
+ * Gives up after TELEMETRY_READ_ATTEMPTS torn copies rather than spinning: a writer that died in the
+ * middle of a publish leaves the sequence odd for good. The caller can tell that apart from a slow
+ * publish by checking whether writerPid is still alive.
+ */
+inline TelemetryRead readTelemetry(const TelemetrySegment *segment, TelemetrySegment &copy)
+{
+  if (segment->magic != TELEMETRY_MAGIC || segment->version != TELEMETRY_VERSION || segment->size != sizeof(TelemetrySegment))
+  {
+    return TELEMETRY_READ_INCOMPATIBLE;
+  }
+
+  for (int attempt = 0; attempt < TELEMETRY_READ_ATTEMPTS; attempt++)
+  {
+    uint64_t before = segment->sequence.load(std::memory_order_acquire);
+    if (before & 1)
+    {
+      std::this_thread::yield();
+      continue;
+    }
+
+    // copy everything after the sequence field; the atomic itself is not trivially copyable
+    copy.publishedNs = segment->publishedNs;
+    copy.sequencer = segment->sequencer;
+    copy.serviceCount = segment->serviceCount;
+    for (uint32_t i = 0; i < TELEMETRY_MAX_SERVICES; i++)
+    {
+      copy.services[i] = segment->services[i];
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (segment->sequence.load(std::memory_order_relaxed) != before)
+    {
+      continue;
+    }
+
+    copy.magic = segment->magic;
+    copy.version = segment->version;
+    copy.size = segment->size;
+    copy.writerPid = segment->writerPid;
+    copy.sequence.store(before, std::memory_order_relaxed);
+    return TELEMETRY_READ_OK;
+  }
+
+  return TELEMETRY_READ_TORN;
+}
+
+/**
+ * Owns the shared-memory segment and the thread that refreshes it.
+ */
+class TelemetryPublisher
+{
+public:
+  /**
+   * @param fill called on the publisher thread with the segment to fill in; runs inside the seqlock.
+   */
+  TelemetryPublisher(std::function<void(TelemetrySegment &)> fill);
+  ~TelemetryPublisher();
+
+  /**
+   * @brief Create the segment and start publishing.
+   * @return false if the segment could not be created.
+   */
+  bool start();
+  void stop();
+
+private:
+  void _run(std::stop_token stop);
+  void _publish();
+
+  std::function<void(TelemetrySegment &)> _fill;
+  TelemetrySegment *_segment = nullptr;
+  std::jthread _thread;
+};
@@ -0,0 +1,180 @@
+/**
+ * @file Trace.cpp
+ */
+
+#include "Trace.hpp"
+
+#include <chrono>
+#include <ctime>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+  std::mutex registryMutex;
+  std::vector<std::unique_ptr<tracing::Ring>> rings;
+  std::vector<std::string> sources;
+
+  std::atomic<bool> enabled{false};
+  std::jthread drainThread;
+  FILE *output = nullptr;
+  uint64_t originNs = 0;
+  bool firstEvent = true;
+  size_t namedRings = 0;
+
+  thread_local tracing::Ring *threadRing = nullptr;
+
+  uint64_t monotonicNs()
+  {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + static_cast<uint64_t>(now.tv_nsec);
+  }
+
+  void writeEvent(const tracing::Ring &ring, const tracing::Record &record)
+  {
+    double ts = static_cast<double>(record.timestampNs - originNs) / 1000.0;
+    const char *name = record.source < sources.size() ? sources[record.source].c_str() : "unknown";
+
+    fprintf(output, "%s\n", firstEvent ? "" : ",");
+    firstEvent = false;
+
+    switch (record.type)
+    {
+      case tracing::TRACE_START:
+        fprintf(output, "{\"name\":\"%s\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"cpu\":%u}}",
+                name, ts, ring.tid(), record.cpu);
+        break;
+      case tracing::TRACE_END:
+        fprintf(output, "{\"name\":\"%s\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"cpu\":%u,\"status\":%u}}",
+                name, ts, ring.tid(), record.cpu, record.status);
+        break;
+      case tracing::TRACE_RELEASE:
+        fprintf(output, "{\"name\":\"release %s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"cpu\":%u}}",
+                name, ts, ring.tid(), record.cpu);
+        break;
+      case tracing::TRACE_TICK:
+        fprintf(output, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"cpu\":%u,\"iteration\":%u}}",
+                name, ts, ring.tid(), record.cpu, record.arg);
+        break;
+    }
+  }
+
+  void drainOnce()
+  {
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    // name threads the first time they show up so the timeline has readable rows
+    for (; namedRings < rings.size(); namedRings++)
+    {
+      const auto &ring = rings[namedRings];
+      fprintf(output, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+              firstEvent ? "" : ",", ring->tid(), ring->threadName().c_str());
+      firstEvent = false;
+    }
+
+    tracing::Record record;
+    for (auto &ring : rings)
+    {
+      while (ring->pop(record))
+      {
+        writeEvent(*ring, record);
+      }
+    }
+    fflush(output);
+  }
+
+  void drainLoop(std::stop_token stop)
+  {
+    // stay off the real-time cores and out of the SCHED_FIFO band
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(TRACE_DRAIN_CORE, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+
+    sched_param sch;
+    sch.sched_priority = 0;
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &sch);
+
+    while (!stop.stop_requested())
+    {
+      drainOnce();
+      std::this_thread::sleep_for(std::chrono::milliseconds(TRACE_DRAIN_PERIOD_MS));
+    }
+  }
+}
+
+uint32_t tracing::registerSource(const std::string &name)
+{
+  std::lock_guard<std::mutex> lock(registryMutex);
+  sources.push_back(name);
+  return static_cast<uint32_t>(sources.size() - 1);
+}
+
+void tracing::registerThread(const std::string &name)
+{
+  if (threadRing != nullptr)
+  {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(registryMutex);
+  rings.push_back(std::make_unique<Ring>(name, static_cast<int>(syscall(SYS_gettid))));
+  threadRing = rings.back().get();
+}
+
+void tracing::record(EventType type, uint32_t source, uint32_t arg, uint8_t status)
+{
+  if (threadRing == nullptr || !enabled.load(std::memory_order_relaxed))
+  {
+    return;
+  }
+
+  int cpu = sched_getcpu();
+  threadRing->push({monotonicNs(), source, arg, static_cast<uint16_t>(cpu < 0 ? 0 : cpu), type, status});
+}
+
+bool tracing::startDrain(const std::string &path)
+{
+  output = fopen(path.c_str(), "w");
+  if (output == nullptr)
+  {
+    return false;
+  }
+
+  // JSON array format; the closing bracket is optional for the viewers if the run dies
+  fprintf(output, "[");
+  originNs = monotonicNs();
+  enabled.store(true);
+  drainThread = std::jthread(drainLoop);
+  return true;
+}
+
+void tracing::stopDrain()
+{
+  if (output == nullptr)
+  {
+    return;
+  }
+
+  enabled.store(false);
+  drainThread.request_stop();
+  drainThread.join();
+  drainOnce();
+
+  uint64_t dropped = 0;
+  for (auto &ring : rings)
+  {
+    dropped += ring->dropped();
+  }
+  if (dropped > 0)
+  {
+    fprintf(stderr, "trace: %llu records dropped, rings were full\n", static_cast<unsigned long long>(dropped));
+  }
+
+  fprintf(output, "\n]\n");
+  fclose(output);
+  output = nullptr;
+}
@@ -0,0 +1,130 @@
+/**
+ * @file Trace.hpp
+ * @brief Per-thread binary trace of releases, executions and sequencer ticks.
+ *
+ * Each traced thread owns a fixed-size single-producer ring, created when the thread registers and
+ * never grown, so recording is a clock read plus a store. A low priority drain thread empties the
+ * rings into a Chrome Trace Event / Perfetto JSON file. If a ring fills the newest records are
+ * dropped and counted rather than blocking the real-time thread.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TRACE_RING_RECORDS 16384 // per thread, power of two
+#define TRACE_DRAIN_PERIOD_MS 50
+#define TRACE_DRAIN_CORE 0
+
+namespace tracing
+{
+  enum EventType : uint8_t
+  {
+    TRACE_RELEASE, // source was released, recorded on the releasing thread
+    TRACE_START,   // source started executing
+    TRACE_END,     // source finished, with its status
+    TRACE_TICK,    // sequencer tick, arg is the iteration
+  };
+
+  struct Record
+  {
+    uint64_t timestampNs; // CLOCK_MONOTONIC
+    uint32_t source;      // id from registerSource
+    uint32_t arg;
+    uint16_t cpu;
+    EventType type;
+    uint8_t status;
+  };
+
+  class Ring
+  {
+  public:
+    Ring(std::string threadName, int tid) : _threadName(threadName), _tid(tid)
+    {
+      _records = std::make_unique<Record[]>(TRACE_RING_RECORDS);
+    }
+
+    bool push(const Record &record)
+    {
+      uint64_t write = _write.load(std::memory_order_relaxed);
+      if (write - _read.load(std::memory_order_acquire) >= TRACE_RING_RECORDS)
+      {
+        _dropped.store(_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return false;
+      }
+
+      _records[write & (TRACE_RING_RECORDS - 1)] = record;
+      _write.store(write + 1, std::memory_order_release);
+      return true;
+    }
+
+    bool pop(Record &record)
+    {
+      uint64_t read = _read.load(std::memory_order_relaxed);
+      if (read == _write.load(std::memory_order_acquire))
+      {
+        return false;
+      }
+
+      record = _records[read & (TRACE_RING_RECORDS - 1)];
+      _read.store(read + 1, std::memory_order_release);
+      return true;
+    }
+
+    const std::string &threadName() const
+    {
+      return _threadName;
+    }
+
+    int tid() const
+    {
+      return _tid;
+    }
+
+    uint64_t dropped() const
+    {
+      return _dropped.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::unique_ptr<Record[]> _records;
+    std::string _threadName;
+    int _tid;
+    alignas(64) std::atomic<uint64_t> _write{0};
+    alignas(64) std::atomic<uint64_t> _read{0};
+    std::atomic<uint64_t> _dropped{0};
+  };
+
+  /**
+   * @brief Name an event source, e.g. a service. Not real-time safe; call at startup.
+   */
+  uint32_t registerSource(const std::string &name);
+
+  /**
+   * @brief Give the calling thread its own ring. Not real-time safe; call before the thread's loop.
+   * Threads that never register record nothing.
+   */
+  void registerThread(const std::string &name);
+
+  /**
+   * @brief Record an event on the calling thread's ring. Never blocks or allocates.
+   */
+  void record(EventType type, uint32_t source, uint32_t arg = 0, uint8_t status = 0);
+
+  /**
+   * @brief Start draining every ring into a Chrome Trace Event JSON file on a low priority thread.
+   * Until this is called record() is a no-op.
+   */
+  bool startDrain(const std::string &path);
+
+  /**
+   * @brief Drain what is left, close the JSON array and join the drain thread.
+   */
+  void stopDrain();
+}